@@ -0,0 +1,67 @@
+#ifndef LIBGIF_BATCH_H
+#define LIBGIF_BATCH_H
+
+#include <gif/gif.h>
+#include <gif/frame_store.h>
+#include <gif/thread_pool.h>
+#include <exception>
+#include <functional>
+#include <future>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace gif {
+
+/**
+ * \brief   A GIF file to decode, either the path of a file or a buffer that
+ *          must stay valid until the file has been decoded.
+ */
+using BatchInput = std::variant<std::string, std::basic_string_view<uint8_t>>;
+
+/**
+ * \class   BatchDecoder
+ * \brief   Decodes many GIF files on a shared work-stealing thread pool.
+ *
+ *  Every file is split into one task that parses the block structure and
+ *  one task per image that runs the LZW decoding, so the images of a large
+ *  animation are spread over the idle workers. Images that repeat an earlier
+ *  image are only decoded once, see FrameStore::duplicateOf. A file that
+ *  fails to decode doesn't affect the rest of the batch.
+ */
+class BatchDecoder
+{
+public:
+    /**
+     * \brief   Invoked from a worker thread when a file has been decoded.
+     *          <frames> is nullptr if the decoding failed, in which case
+     *          <error> holds the reason. Exceptions thrown by the callback
+     *          are ignored, they don't change the result of the file.
+     */
+    using Callback = std::function<void(
+        size_t index, const FrameStore* frames, std::exception_ptr error)>;
+
+    /**
+     * \brief   Creates a decoder with <threads> workers. The limits apply to
+     *          each file, the time limit covers all the work on a file.
+     */
+    explicit BatchDecoder(
+        size_t threads = 0,
+        const DecodeLimits& limits = DecodeLimits());
+
+    /**
+     * \brief   Schedules the decoding of <inputs>. Returns one future per
+     *          input, holding the decoded frames or the decoding error.
+     */
+    std::vector<std::future<FrameStore>> decode(
+        const std::vector<BatchInput>& inputs,
+        Callback callback = nullptr);
+
+private:
+    ThreadPool pool_;
+    DecodeLimits limits_;
+};
+
+} // namespace gif
+
+#endif // LIBGIF_BATCH_H
@@ -15,6 +15,10 @@ public:
 
     unsigned GetBits(size_t count);
     std::basic_string_view<uint8_t>::const_iterator readDataTerminator();
+    std::basic_string_view<uint8_t>::const_iterator skipRemainingBlocks();
+
+    // the position of the next byte to read
+    std::basic_string_view<uint8_t>::const_iterator position() const { return iterator_; }
 
 private:
     std::basic_string_view<uint8_t>::const_iterator iterator_;
@@ -22,6 +26,7 @@ private:
     uint8_t byte_;
     uint8_t bitsLeftInByte_;
     uint8_t bytesInBlock_;
+    bool terminated_;
 };
 
 } // namespace gif
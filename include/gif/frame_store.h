@@ -0,0 +1,128 @@
+#ifndef LIBGIF_FRAME_STORE_H
+#define LIBGIF_FRAME_STORE_H
+
+#include <gif/gif.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace gif {
+
+/**
+ * \class   FrameStore
+ * \brief   Compact in-memory storage of a decoded animation.
+ *
+ *  Each frame is kept as the color indices of its image rectangle together
+ *  with a reference to its color table, optionally run-length encoded. Frames
+ *  are only expanded to RGBA when they are read. Reading a frame composites
+ *  it starting from the closest preceding key frame, that is a frame that
+ *  covers the whole canvas without any transparency, or from the closest
+ *  preceding checkpoint. A checkpoint stores the canvas, possibly run-length
+ *  encoded, every <checkpointInterval> frames without a key frame, which
+ *  bounds the number of frames drawn by a read. A interval of zero disables
+ *  the checkpoints, in which case reading frame n of a animation without key
+ *  frames draws all n frames.
+ */
+class FrameStore
+{
+public:
+    explicit FrameStore(
+        const LogicalScreenDescriptor& screen,
+        bool compress = true,
+        size_t checkpointInterval = 32);
+
+    /**
+     * \brief   Decodes a image and appends it to the store. A image that
+     *          repeats a earlier image is stored as a duplicate of it.
+     */
+    std::basic_string_view<uint8_t>::const_iterator add(
+        std::basic_string_view<uint8_t>::const_iterator& it,
+        std::basic_string_view<uint8_t>::const_iterator end,
+        const ImageDescriptor& descriptor,
+        const ColorTable& table,
+        const GraphicControlExtension* gce,
+        const DecodeLimits* limits = nullptr);
+
+    /**
+     * \brief   Appends a image that already has been decoded into color
+     *          indices. A image that repeats a earlier image is stored as a
+     *          duplicate of it.
+     */
+    void add(
+        const ImageDescriptor& descriptor,
+        const ColorTable& table,
+        const GraphicControlExtension* gce,
+        const std::vector<uint8_t>& indices);
+
+    /**
+     * \brief   Appends a frame that repeats the image of the frame at <index>.
+     *          The image data is shared with the original frame.
+     */
+    void addDuplicate(
+        size_t index,
+        const GraphicControlExtension* gce);
+
+    /**
+     * \brief   Composites the frame at <index> into a RGBA canvas. The canvas
+     *          must have the dimensions of the logical screen.
+     */
+    void read(size_t index, Frame& canvas) const;
+
+    /**
+     * \brief   Returns the number of stored frames.
+     */
+    size_t size() const { return frames_.size(); }
+
+    /**
+     * \brief   Returns the number of bytes used by the stored frames.
+     */
+    size_t memoryUsage() const;
+
+    const LogicalScreenDescriptor& screen() const { return screen_; }
+    const ImageDescriptor& descriptor(size_t index) const;
+    const GraphicControlExtension* graphicControl(size_t index) const;
+
+    /**
+     * \brief   Returns the index of the first frame with the same image as the
+     *          frame at <index>, or <index> itself if the image is unique.
+     */
+    size_t duplicateOf(size_t index) const;
+
+private:
+    struct StoredFrame
+    {
+        ImageDescriptor descriptor;
+        GraphicControlExtension gce;
+        bool hasGraphicControl;
+        bool compressed;
+        size_t palette;             // index into palettes_
+        size_t keyFrame;            // frame that reads start from
+        size_t original;            // frame that owns the data
+        // color indices, possibly run-length encoded
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        // the canvas before the frame is drawn, if the frame is a checkpoint
+        std::shared_ptr<const std::vector<uint8_t>> checkpoint;
+        bool checkpointCompressed;
+    };
+
+    void append(StoredFrame frame);
+    size_t addPalette(const ColorTable& table);
+    bool repeats(
+        const StoredFrame& frame,
+        const StoredFrame& original,
+        const std::vector<uint8_t>& indices) const;
+    void composite(size_t index, Frame& canvas, bool dispose) const;
+    void draw(const StoredFrame& frame, Frame& canvas) const;
+
+    LogicalScreenDescriptor screen_;
+    bool compress_;
+    size_t checkpointInterval_;
+    std::vector<ColorTable> palettes_;
+    std::vector<StoredFrame> frames_;
+    // the frames that own their data, by the hash of their image
+    std::unordered_multimap<uint64_t, size_t> images_;
+};
+
+} // namespace gif
+
+#endif // LIBGIF_FRAME_STORE_H
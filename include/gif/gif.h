@@ -6,6 +6,8 @@
 #include <string>
 #include <array>
 #include <string_view>
+#include <functional>
+#include <chrono>
 
 namespace gif {
 
@@ -91,6 +93,17 @@ struct ImageDescriptor
     uint8_t localColorTableSize : 3;
 };
 
+/**
+ * \struct  Rect
+ */
+struct Rect
+{
+    size_t left;
+    size_t top;
+    size_t width;
+    size_t height;
+};
+
 /**
  * \struct  GraphicControlExtension
  */
@@ -112,6 +125,58 @@ struct ApplicationExtension
     std::array<uint8_t, 3> code;
 };
 
+/**
+ * \struct  DecodeLimits
+ * \brief   Resource limits that are enforced while parsing untrusted input. A
+ *          zero value means that the quantity isn't limited.
+ *
+ *  The decoders of a single image check its rectangle against the pixel
+ *  limits before decoding it, and ParseFileLayout checks the logical screen,
+ *  the number of images and their total size.
+ */
+struct DecodeLimits
+{
+    // the number of pixels of the logical screen
+    uint64_t maxCanvasPixels = 0;
+    // the total number of pixels of all the images in a file
+    uint64_t maxTotalPixels = 0;
+    // the number of images in a file
+    size_t maxFrames = 0;
+    // the number of color indices produced by the LZW data of a single image,
+    // including any data beyond the image rectangle
+    uint64_t maxFrameOutput = 0;
+    // the wall time spent parsing a file or decoding a image
+    std::chrono::milliseconds maxTime{0};
+};
+
+/**
+ * \struct  ImageBlock
+ * \brief   The parameters and location of a single image in a GIF file.
+ */
+struct ImageBlock
+{
+    ImageDescriptor descriptor;
+    ColorTable localColorTable;
+    GraphicControlExtension gce;
+    bool hasGraphicControl;
+    // the LZW minimum code size byte that starts the image data
+    std::basic_string_view<uint8_t>::const_iterator data;
+    // the data following the image data terminator
+    std::basic_string_view<uint8_t>::const_iterator next;
+};
+
+/**
+ * \struct  FileLayout
+ * \brief   The block structure of a complete GIF file.
+ */
+struct FileLayout
+{
+    Version version;
+    LogicalScreenDescriptor screen;
+    ColorTable globalColorTable;
+    std::vector<ImageBlock> images;
+};
+
 uint8_t PeekByte(
     std::basic_string_view<uint8_t>::const_iterator& it,
     std::basic_string_view<uint8_t>::const_iterator end);
@@ -138,6 +203,13 @@ std::string ParseString(
     std::basic_string_view<uint8_t>::const_iterator end,
     size_t length);
 
+/**
+ * \brief   Skips a sequence of data sub-blocks, including the block terminator.
+ */
+void SkipSubBlocks(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end);
+
 /**
  * \struct  Parses the GIF header
  */
@@ -188,7 +260,109 @@ std::basic_string_view<uint8_t>::const_iterator ParseImageData(
     const gif::ImageDescriptor& descriptor,
     Frame& frame,
     const gif::ColorTable& table,
-    const GraphicControlExtension* gce);
+    const GraphicControlExtension* gce,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Parses the part of a image frame that is inside <region>, given in
+ *          frame coordinates. Pixels outside the region are not painted, and
+ *          the decoding stops after the last row of the region, skipping the
+ *          remaining image data. The rows of a interlaced image are stored in
+ *          several passes, its decoding stops after the row of the region
+ *          that is stored last.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageRegion(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    const Rect& region,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Parses a image frame into color indices. The result holds
+ *          descriptor.width * descriptor.height indices, stored row by row.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageIndices(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    std::vector<uint8_t>& indices,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Parses a image frame using a two stage pipeline. The calling thread
+ *          runs the LZW decoding and queues the decoded rows, which are
+ *          expanded and painted into the frame by <workers> threads.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataPipelined(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t workers = 1,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Parses a image frame on <threads> threads, or on all the hardware
+ *          threads if <threads> is zero. A first pass over the image data
+ *          finds the clear codes, then the segments between them are decoded
+ *          in parallel, as each clear code resets the LZW dictionary. Image
+ *          data without clear codes is decoded on a single thread.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataParallel(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t threads = 0,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Receives a band of decoded rows. <y> is the canvas row of the first
+ *          row in the band, and <rows> the number of valid rows in <band>.
+ */
+using BandCallback = std::function<void(size_t y, size_t rows, const Frame& band)>;
+
+/**
+ * \brief   Parses a non-interlaced image frame, delivering the decoded pixels
+ *          in bands of <bandHeight> rows. The band storage is reused between
+ *          callbacks, so only width * bandHeight pixels are kept in memory.
+ *          Transparent pixels are delivered with a zero alpha value.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageBands(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t bandHeight,
+    const BandCallback& callback,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Parses the block structure of a complete GIF file without decoding
+ *          any image data. The canvas, frame and pixel limits are checked as
+ *          the blocks are parsed, before any image data has been decoded.
+ */
+FileLayout ParseFileLayout(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const DecodeLimits* limits = nullptr);
+
+/**
+ * \brief   Finds images that repeat an earlier image, by hashing their
+ *          compressed data together with their image descriptor, color table
+ *          and transparency. Returns the index of the first identical image
+ *          for every image, or the index of the image itself if it is unique.
+ */
+std::vector<size_t> FindDuplicateImages(const FileLayout& layout);
 
 } // namespace gif
 
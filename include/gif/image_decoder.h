@@ -0,0 +1,79 @@
+#ifndef LIBGIF_IMAGE_DECODER_H
+#define LIBGIF_IMAGE_DECODER_H
+
+#include <gif/gif.h>
+#include <chrono>
+#include <memory>
+
+namespace gif {
+
+enum class DecodeStatus {
+    kInProgress,
+    kComplete
+};
+
+/**
+ * \struct  DecodeBudget
+ * \brief   The amount of work that a single call to ImageDecoder::decode may
+ *          perform. A zero value means that the quantity isn't limited. The
+ *          pixel and time budgets are checked every few codes, so a call may
+ *          overshoot them slightly.
+ */
+struct DecodeBudget
+{
+    size_t codes = 0;
+    size_t pixels = 0;
+    std::chrono::microseconds time{0};
+};
+
+/**
+ * \class   ImageDecoder
+ * \brief   Resumable decoding of a single image.
+ *
+ *  The decoding can be split over several calls to decode(), each limited by
+ *  a budget, which allows many images to be decoded cooperatively on a few
+ *  threads. The input data and the frame must stay valid until the decoding
+ *  has completed. The DecodeLimits::maxTime limit only counts the time spent
+ *  in decode(), not the time between the calls.
+ */
+class ImageDecoder
+{
+public:
+    ImageDecoder(
+        std::basic_string_view<uint8_t>::const_iterator it,
+        std::basic_string_view<uint8_t>::const_iterator end,
+        const ImageDescriptor& descriptor,
+        Frame& frame,
+        const ColorTable& table,
+        const GraphicControlExtension* gce,
+        const DecodeLimits* limits = nullptr);
+    ~ImageDecoder();
+
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    /**
+     * \brief   Continues the decoding until the image is complete or the
+     *          budget is spent.
+     */
+    DecodeStatus decode(const DecodeBudget& budget);
+
+    /**
+     * \brief   Returns the number of pixels decoded so far.
+     */
+    size_t decodedPixels() const;
+
+    /**
+     * \brief   Returns a iterator to the data following the image, only valid
+     *          once the decoding is complete.
+     */
+    std::basic_string_view<uint8_t>::const_iterator next() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+} // namespace gif
+
+#endif // LIBGIF_IMAGE_DECODER_H
@@ -0,0 +1,45 @@
+#ifndef LIBGIF_REMUX_H
+#define LIBGIF_REMUX_H
+
+#include <gif/gif.h>
+#include <vector>
+
+namespace gif {
+
+/**
+ * \struct  RemuxOptions
+ */
+struct RemuxOptions
+{
+    // keeps the original looping extension, if any
+    static const int kKeepLoopCount = -1;
+    // removes the looping extension
+    static const int kNoLoopCount = -2;
+
+    // the index of the first frame to copy
+    size_t first = 0;
+    // the number of frames to copy, zero copies all the following frames
+    size_t count = 0;
+    // the loop count written to the NETSCAPE2.0 extension, zero loops forever
+    int loopCount = kKeepLoopCount;
+};
+
+/**
+ * \brief   Writes a new GIF file holding a range of the frames of <data>.
+ *
+ *  The header, color tables, extensions and the LZW data of the selected
+ *  frames are copied byte for byte, and comment extensions are dropped. The
+ *  image data is only decoded if the first selected frame is drawn on top of
+ *  earlier frames, in which case the frames are composited and re-encoded
+ *  until the canvas matches the original again. A re-encoded frame covers the
+ *  whole canvas, and a frame with more colors than fit in a color table is
+ *  split into several images that are shown without delay in between.
+ */
+std::vector<uint8_t> RemuxGif(
+    std::basic_string_view<uint8_t> data,
+    const RemuxOptions& options,
+    const DecodeLimits* limits = nullptr);
+
+} // namespace gif
+
+#endif // LIBGIF_REMUX_H
@@ -0,0 +1,134 @@
+#ifndef LIBGIF_SHARED_CACHE_H
+#define LIBGIF_SHARED_CACHE_H
+
+#include <gif/frame_store.h>
+#include <gif/gif.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gif {
+
+/**
+ * \class   SharedFrames
+ * \brief   The composited RGBA frames of a animation, either mapped read-only
+ *          from a shared memory segment of a SharedFrameCache or, if the
+ *          animation didn't fit in the cache, held in a private FrameStore
+ *          that composites a frame when it's read.
+ */
+class SharedFrames
+{
+public:
+    ~SharedFrames();
+
+    SharedFrames(const SharedFrames&) = delete;
+    SharedFrames& operator=(const SharedFrames&) = delete;
+
+    size_t size() const { return count_; }
+    size_t width() const { return width_; }
+    size_t height() const { return height_; }
+
+    /**
+     * \brief   Returns the RGBA pixels of the frame at <index>, stored row by
+     *          row with a pitch of width() * 4 bytes. If the frames aren't
+     *          shared, the pixels are only valid until the next call.
+     */
+    const uint8_t* pixels(size_t index) const;
+
+    /**
+     * \brief   Returns the delay of the frame at <index>, in hundredths of a
+     *          second.
+     */
+    uint16_t delay(size_t index) const;
+
+    /**
+     * \brief   Returns true if the frames are mapped from shared memory.
+     */
+    bool shared() const { return static_cast<bool>(release_); }
+
+private:
+    friend class SharedFrameCache;
+
+    SharedFrames(
+        const uint8_t* base,
+        size_t size,
+        std::function<void()> release);
+    explicit SharedFrames(std::unique_ptr<FrameStore> store);
+
+    const uint8_t* base_;           // the start of the segment
+    size_t mappedSize_;             // the size of the mapping
+    std::function<void()> release_;
+    size_t count_;
+    size_t width_;
+    size_t height_;
+    const uint8_t* pixels_;
+    // the frames, if they aren't shared, and the last frame read from them
+    std::unique_ptr<FrameStore> store_;
+    mutable std::mutex mutex_;
+    mutable std::unique_ptr<Frame> canvas_;
+    mutable size_t current_;
+};
+
+/**
+ * \class   SharedFrameCache
+ * \brief   A cache of decoded animations that is shared between processes.
+ *
+ *  Animations are keyed by the SHA-256 digest of the file contents. Each
+ *  animation lives in a POSIX shared memory segment that is mapped read-only
+ *  into every process that asks for it, so a popular file is only decoded
+ *  once and only kept in memory once. The entries are reference counted, and
+ *  entries that aren't referenced are evicted in least recently used order to
+ *  keep the total size of the segments within the byte budget. References are
+ *  recorded per process, so the references of a process that died are
+ *  dropped before entries are evicted.
+ *
+ *  The cache state is kept in a control segment named <name>, which must
+ *  start with a slash, and the data segments are named <name>.<id>. The
+ *  first process to open the cache creates the control segment, with
+ *  <budget> and <entries>, the following processes use its settings.
+ */
+class SharedFrameCache
+{
+public:
+    SharedFrameCache(
+        const std::string& name,
+        size_t budget,
+        size_t entries = 1024);
+    ~SharedFrameCache();
+
+    SharedFrameCache(const SharedFrameCache&) = delete;
+    SharedFrameCache& operator=(const SharedFrameCache&) = delete;
+
+    /**
+     * \brief   Returns the frames of a GIF file, decoding the file if it isn't
+     *          cached yet. If another process is decoding the same file, the
+     *          call waits for it to finish. Files that don't fit in the budget
+     *          are decoded into a private FrameStore, so that they aren't
+     *          held as RGBA frames either.
+     */
+    std::shared_ptr<const SharedFrames> get(
+        std::basic_string_view<uint8_t> data,
+        const DecodeLimits* limits = nullptr);
+
+    /**
+     * \brief   Returns the total size of the cached segments, in bytes.
+     */
+    size_t memoryUsage() const;
+
+    /**
+     * \brief   Removes the control segment and all data segments of the cache
+     *          named <name>. Processes that have the cache open keep working
+     *          on their mappings, but new processes create a new cache.
+     */
+    static void remove(const std::string& name);
+
+private:
+    struct Impl;
+    std::shared_ptr<Impl> impl_;
+};
+
+} // namespace gif
+
+#endif // LIBGIF_SHARED_CACHE_H
@@ -0,0 +1,67 @@
+#ifndef LIBGIF_THREAD_POOL_H
+#define LIBGIF_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gif {
+
+/**
+ * \class   ThreadPool
+ * \brief   A work-stealing thread pool.
+ *
+ *  Every worker has its own task queue. Tasks submitted from a worker are
+ *  pushed onto the queue of that worker and executed in LIFO order, while
+ *  idle workers steal the oldest tasks from the other queues.
+ */
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * \brief   Creates a pool with <threads> workers, or one worker per
+     *          hardware thread if <threads> is zero.
+     */
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * \brief   Schedules a task for execution. Tasks must not throw.
+     */
+    void submit(Task task);
+
+    size_t size() const { return workers_.size(); }
+
+private:
+    struct Worker
+    {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    bool pop(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> nextWorker_;
+    // guards pending_ and stop_, and is held while a task is taken
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    size_t pending_;
+    bool stop_;
+};
+
+} // namespace gif
+
+#endif // LIBGIF_THREAD_POOL_H
@@ -0,0 +1,35 @@
+#ifndef LIBGIF_VALIDATION_H
+#define LIBGIF_VALIDATION_H
+
+#include <gif/gif.h>
+#include <string>
+
+namespace gif {
+
+/**
+ * \struct  ValidationResult
+ */
+struct ValidationResult
+{
+    bool valid;
+    size_t offset;          // byte offset where the error was detected
+    size_t image;           // index of the image with the error, if any
+    std::string message;
+};
+
+/**
+ * \brief   Checks the structure and the LZW data of a complete GIF file
+ *          without painting any pixels.
+ *
+ *  Every block and sub-block length is checked against the file size, every
+ *  image must lie within the logical screen, every LZW code must be legal for
+ *  the current state of the dictionary, the number of decoded pixels must
+ *  match each image descriptor, and the file must end with a trailer.
+ */
+ValidationResult ValidateGif(
+    std::basic_string_view<uint8_t> data,
+    const DecodeLimits* limits = nullptr);
+
+} // namespace gif
+
+#endif // LIBGIF_VALIDATION_H
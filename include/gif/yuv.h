@@ -0,0 +1,67 @@
+#ifndef LIBGIF_YUV_H
+#define LIBGIF_YUV_H
+
+#include <gif/gif.h>
+#include <vector>
+
+namespace gif {
+
+enum class YuvFormat {
+    kI420,      // planar Y, U and V
+    kNV12       // planar Y followed by interleaved UV
+};
+
+enum class ColorMatrix {
+    kBt601,
+    kBt709
+};
+
+/**
+ * \struct  YuvFrame
+ * \brief   A limited range YUV 4:2:0 frame.
+ */
+struct YuvFrame
+{
+    YuvFrame(size_t w, size_t h, YuvFormat f) :
+        width(w),
+        height(h),
+        chromaWidth((w + 1) / 2),
+        chromaHeight((h + 1) / 2),
+        format(f),
+        y(w * h, 16),
+        u((f == YuvFormat::kNV12 ? 2 : 1) * chromaWidth * chromaHeight, 128),
+        v((f == YuvFormat::kNV12 ? 0 : 1) * chromaWidth * chromaHeight, 128)
+    {
+        // empty
+    }
+
+    size_t width;
+    size_t height;
+    size_t chromaWidth;
+    size_t chromaHeight;
+    YuvFormat format;
+    std::vector<uint8_t> y;     // luma plane, width * height
+    std::vector<uint8_t> u;     // U plane for I420, interleaved UV for NV12
+    std::vector<uint8_t> v;     // V plane for I420, empty for NV12
+};
+
+/**
+ * \brief   Parses a image frame directly into a YUV frame. The color table is
+ *          converted to YUV once, and the chroma of each 2x2 block is the
+ *          average of its pixels. Transparent pixels keep the previous
+ *          contents of the frame, both for luma and for their share of the
+ *          chroma.
+ */
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataYuv(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    YuvFrame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    ColorMatrix matrix = ColorMatrix::kBt601,
+    const DecodeLimits* limits = nullptr);
+
+} // namespace gif
+
+#endif // LIBGIF_YUV_H
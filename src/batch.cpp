@@ -0,0 +1,207 @@
+/**
+ * \file    batch.cpp
+ */
+
+#include <gif/batch.h>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace gif {
+
+namespace {
+
+/**
+ * \struct  FileJob
+ * \brief   The shared state of the tasks that decode a single file.
+ */
+struct FileJob
+{
+    size_t index;
+    BatchInput input;
+    BatchDecoder::Callback callback;
+    std::promise<FrameStore> promise;
+    DecodeLimits limits;
+    std::chrono::steady_clock::time_point start;
+
+    std::vector<uint8_t> buffer;    // file contents, if the input is a path
+    std::basic_string_view<uint8_t> view;
+    FileLayout layout;
+    std::vector<size_t> duplicates;
+    std::vector<std::vector<uint8_t>> indices;
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::exception_ptr error;
+};
+
+std::vector<uint8_t> ReadFile(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+    std::vector<uint8_t> result(
+        (std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        throw std::runtime_error("Failed to read " + path);
+    }
+    return result;
+}
+
+// builds the frame store of a job from the decoded indices
+std::unique_ptr<FrameStore> buildFrames(FileJob& job)
+{
+    auto frames = std::make_unique<FrameStore>(job.layout.screen);
+    for(size_t i = 0; i < job.layout.images.size(); ++i) {
+        const auto& image = job.layout.images[i];
+        if (job.duplicates[i] != i) {
+            // repeated images are only decoded once
+            frames->addDuplicate(
+                job.duplicates[i],
+                image.hasGraphicControl ? &image.gce : nullptr);
+            continue;
+        }
+        frames->add(
+            image.descriptor,
+            image.descriptor.localColorTable ? image.localColorTable : job.layout.globalColorTable,
+            image.hasGraphicControl ? &image.gce : nullptr,
+            job.indices[i]);
+        job.indices[i] = std::vector<uint8_t>();
+    }
+    return frames;
+}
+
+// reports the result of a job once all of its tasks have finished
+void complete(FileJob& job)
+{
+    std::unique_ptr<FrameStore> frames;
+    if (!job.error) {
+        try {
+            frames = buildFrames(job);
+        }
+        catch(...) {
+            job.error = std::current_exception();
+        }
+    }
+
+    if (job.callback) {
+        try {
+            job.callback(job.index, frames.get(), frames ? nullptr : job.error);
+        }
+        catch(...) {
+            // a failing callback doesn't change the result of the file
+        }
+    }
+    if (frames) {
+        job.promise.set_value(std::move(*frames));
+    }
+    else {
+        job.promise.set_exception(job.error);
+    }
+}
+
+void decodeImage(const std::shared_ptr<FileJob>& job, size_t image)
+{
+    try {
+        // the time limit covers the whole file, so only the time left is
+        // available for this image
+        DecodeLimits limits = job->limits;
+        if (limits.maxTime.count() > 0) {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - job->start);
+            if (elapsed >= limits.maxTime) {
+                throw std::runtime_error("Decoding time limit exceeded.");
+            }
+            limits.maxTime -= elapsed;
+        }
+        auto it = job->layout.images[image].data;
+        ParseImageIndices(
+            it,
+            job->view.end(),
+            job->layout.images[image].descriptor,
+            job->indices[image],
+            &limits);
+    }
+    catch(...) {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        if (!job->error) {
+            job->error = std::current_exception();
+        }
+    }
+    if (--job->remaining == 0) {
+        complete(*job);
+    }
+}
+
+void decodeFile(ThreadPool& pool, const std::shared_ptr<FileJob>& job)
+{
+    job->start = std::chrono::steady_clock::now();
+    try {
+        if (auto path = std::get_if<std::string>(&job->input)) {
+            job->buffer = ReadFile(*path);
+            job->view = std::basic_string_view<uint8_t>(job->buffer.data(), job->buffer.size());
+        }
+        else {
+            job->view = std::get<std::basic_string_view<uint8_t>>(job->input);
+        }
+        auto it = job->view.begin();
+        job->layout = ParseFileLayout(it, job->view.end(), &job->limits);
+        job->duplicates = FindDuplicateImages(job->layout);
+    }
+    catch(...) {
+        job->error = std::current_exception();
+        complete(*job);
+        return;
+    }
+
+    const size_t count = job->layout.images.size();
+    size_t unique = 0;
+    for(size_t i = 0; i < count; ++i) {
+        unique += (job->duplicates[i] == i) ? 1 : 0;
+    }
+    if (unique == 0) {
+        complete(*job);
+        return;
+    }
+    job->indices.resize(count);
+    job->remaining = unique;
+    for(size_t i = 0; i < count; ++i) {
+        if (job->duplicates[i] == i) {
+            pool.submit([job, i]() { decodeImage(job, i); });
+        }
+    }
+}
+
+} // namespace
+
+BatchDecoder::BatchDecoder(
+    size_t threads,
+    const DecodeLimits& limits) :
+    pool_(threads),
+    limits_(limits)
+{
+    // empty
+}
+
+std::vector<std::future<FrameStore>> BatchDecoder::decode(
+    const std::vector<BatchInput>& inputs,
+    Callback callback)
+{
+    std::vector<std::future<FrameStore>> result;
+    for(size_t i = 0; i < inputs.size(); ++i) {
+        auto job = std::make_shared<FileJob>();
+        job->index = i;
+        job->input = inputs[i];
+        job->callback = callback;
+        job->limits = limits_;
+        result.push_back(job->promise.get_future());
+        pool_.submit([this, job]() { decodeFile(pool_, job); });
+    }
+    return result;
+}
+
+} // namespace gif
@@ -1,6 +1,7 @@
 #include <gif/bit_stream.h>
 #include <gif/gif.h>
 #include <assert.h>
+#include <stdexcept>
 
 namespace gif {
 
@@ -13,6 +14,8 @@ BitStream::BitStream(
     bitsLeftInByte_(0)
 {
     bytesInBlock_ = ParseByte(iterator_, end_);
+    // a first block of size 0 is the terminator, there's no data at all
+    terminated_ = (bytesInBlock_ == 0);
 }
 
 unsigned BitStream::GetBits(size_t count)
@@ -20,21 +23,22 @@ unsigned BitStream::GetBits(size_t count)
     unsigned result = 0;
     for(size_t i = 0; i < count; ++i) {
         if (bitsLeftInByte_ == 0) {
-            if (iterator_ == end_) {
-                throw std::runtime_error(
-                    "Reached EOF, can't read any more bytes from input.");
-            }
-            if (bytesInBlock_ > 0) {
-                // there are still data in the block
-                --bytesInBlock_;
-            }
-            else {
+            if (bytesInBlock_ == 0) {
+                // the current block is used up, read the size of the next one
+                if (terminated_) {
+                    throw std::runtime_error("Reached null terminator block.");
+                }
                 bytesInBlock_ = ParseByte(iterator_, end_);
                 if (!bytesInBlock_) {
+                    terminated_ = true;
                     throw std::runtime_error("Reached null terminator block.");
                 }
-                --bytesInBlock_;
             }
+            if (iterator_ == end_) {
+                throw std::runtime_error(
+                    "Reached EOF, can't read any more bytes from input.");
+            }
+            --bytesInBlock_;
 
             byte_ = *iterator_;
             bitsLeftInByte_ = 8;
@@ -51,11 +55,17 @@ unsigned BitStream::GetBits(size_t count)
 
 std::basic_string_view<uint8_t>::const_iterator BitStream::readDataTerminator()
 {
+    if (terminated_) {
+        // the terminator block has already been read
+        return iterator_;
+    }
     // skip any remaining bytes in the current block
-    while(bytesInBlock_ > 0) {
-        ++iterator_;
-        --bytesInBlock_;
+    if (static_cast<size_t>(end_ - iterator_) < bytesInBlock_) {
+        throw std::runtime_error(
+            "Reached EOF, can't read any more bytes from input.");
     }
+    iterator_ += bytesInBlock_;
+    bytesInBlock_ = 0;
     // now read the null terminator block
     if (ParseByte(iterator_, end_) != 0x00) {
         throw std::runtime_error("Expected null terminator block");
@@ -64,4 +74,23 @@ std::basic_string_view<uint8_t>::const_iterator BitStream::readDataTerminator()
     return iterator_;
 }
 
+std::basic_string_view<uint8_t>::const_iterator BitStream::skipRemainingBlocks()
+{
+    if (terminated_) {
+        // the terminator block has already been read
+        return iterator_;
+    }
+    // skip any remaining bytes in the current block
+    if (static_cast<size_t>(end_ - iterator_) < bytesInBlock_) {
+        throw std::runtime_error(
+            "Reached EOF, can't read any more bytes from input.");
+    }
+    iterator_ += bytesInBlock_;
+    bytesInBlock_ = 0;
+    bitsLeftInByte_ = 0;
+    // skip the following blocks by their length, up to the terminator block
+    SkipSubBlocks(iterator_, end_);
+    return iterator_;
+}
+
 } // namespace gif
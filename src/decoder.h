@@ -0,0 +1,790 @@
+/**
+ * \file    decoder.h
+ *
+ * \brief   Internal LZW decoding helpers shared by the different decoding
+ *          modes of the library.
+ */
+
+#ifndef GIF_DECODER_H
+#define GIF_DECODER_H
+
+#include <gif/gif.h>
+#include <gif/bit_stream.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace gif {
+namespace detail {
+
+struct Dictionary
+{
+    std::array<int16_t, 4096> prefix;
+    std::array<int16_t, 4096> length;
+    std::array<uint8_t, 4096> byteValue;
+    uint16_t minCodeSize;
+    uint16_t codeLength;
+    uint16_t clearCode;
+    uint16_t eoiCode;
+    uint16_t currentIndex;
+    uint16_t maxCode;
+};
+
+// resets a dictionary
+inline void reset(Dictionary& dictionary)
+{
+    const size_t dictionarySize = (1 << dictionary.minCodeSize);
+    dictionary.codeLength = dictionary.minCodeSize + 1;
+    dictionary.clearCode = dictionarySize;
+    dictionary.eoiCode = dictionary.clearCode + 1;
+    dictionary.currentIndex = dictionary.clearCode + 2;
+    dictionary.maxCode = (1 << dictionary.codeLength) - 1;
+}
+
+// initializes a dictionary with the initial values
+inline void init(Dictionary& dictionary, size_t minCodeSize)
+{
+    dictionary.minCodeSize = minCodeSize;
+    size_t dictionarySize = (1 << minCodeSize);
+    for(size_t i = 0; i < dictionarySize; i++) {
+        dictionary.prefix[i] = -1;
+        dictionary.byteValue[i] = static_cast<uint8_t>(i);
+        dictionary.length[i] = 1;
+    }
+    reset(dictionary);
+}
+
+inline size_t add(Dictionary& dictionary, int prefix, uint8_t byteValue)
+{
+    auto& ci = dictionary.currentIndex;
+    if (ci < 4096) {
+        if ((ci == dictionary.maxCode) && (dictionary.codeLength < 12)) {
+            ++dictionary.codeLength;
+            dictionary.maxCode = (1 << dictionary.codeLength) - 1;
+        }
+        dictionary.prefix[ci] = prefix;
+        dictionary.byteValue[ci] = byteValue;
+        dictionary.length[ci] = ((prefix < 0) ? 0 : dictionary.length[prefix]) + 1;
+        // return the index where the entry was inserted
+        return ci++;
+    }
+    return ci;
+}
+
+// get the first byte associated with a dictionary entry
+inline uint8_t getFirstByte(
+    const Dictionary& dictionary,
+    size_t index)
+{
+    size_t i = index;
+    while(dictionary.prefix[i] != -1) {
+        i = dictionary.prefix[i];
+    }
+    return dictionary.byteValue[i];
+}
+
+/**
+ * \struct  Palette
+ * \brief   A color table padded to 256 entries, so that any color index in the
+ *          image data can be looked up without a range check. Missing
+ *          entries are black.
+ */
+struct Palette
+{
+    explicit Palette(const ColorTable& table)
+    {
+        const size_t count = std::min<size_t>(table.size(), colors.size());
+        std::copy(table.begin(), table.begin() + count, colors.begin());
+        std::fill(colors.begin() + count, colors.end(), Color{0, 0, 0});
+    }
+
+    const Color& operator[](size_t index) const { return colors[index]; }
+
+    std::array<Color, 256> colors;
+};
+
+/**
+ * \brief   Throws if the image rectangle doesn't fit inside the frame.
+ */
+inline void checkBounds(const ImageDescriptor& descriptor, const Frame& frame)
+{
+    if ((size_t(descriptor.left) + descriptor.width > frame.width) ||
+        (size_t(descriptor.top) + descriptor.height > frame.height))
+    {
+        throw std::runtime_error("The image doesn't fit inside the frame.");
+    }
+}
+
+/**
+ * \brief   Throws if the image rectangle alone exceeds the pixel limits.
+ */
+inline void checkLimits(const ImageDescriptor& descriptor, const DecodeLimits* limits)
+{
+    if (!limits) {
+        return;
+    }
+    const uint64_t pixels = uint64_t(descriptor.width) * descriptor.height;
+    if ((limits->maxCanvasPixels && (pixels > limits->maxCanvasPixels)) ||
+        (limits->maxTotalPixels && (pixels > limits->maxTotalPixels)))
+    {
+        throw std::runtime_error("Image exceeds the pixel limit.");
+    }
+}
+
+/**
+ * \brief   Returns the row of a interlaced image that the <y>th row of its
+ *          image data is shown at. The rows are stored in four passes, every
+ *          8th row starting at row 0, every 8th row starting at row 4, every
+ *          4th row starting at row 2 and every 2nd row starting at row 1.
+ */
+inline size_t interlacedRow(size_t y, size_t height)
+{
+    const size_t first = (height + 7) / 8;
+    const size_t second = (height + 3) / 8;
+    const size_t third = (height + 1) / 4;
+    if (y < first) {
+        return y * 8;
+    }
+    y -= first;
+    if (y < second) {
+        return 4 + (y * 8);
+    }
+    y -= second;
+    if (y < third) {
+        return 2 + (y * 4);
+    }
+    return 1 + ((y - third) * 2);
+}
+
+/**
+ * \brief   Expands a row of color indices to RGBA pixels. Pixels that use the
+ *          transparent color index of the graphic control extension are left
+ *          untouched.
+ */
+inline void expandRow(
+    const uint8_t* indices,
+    size_t count,
+    const Palette& table,
+    const GraphicControlExtension* gce,
+    uint8_t* dst)
+{
+    if (gce && gce->transparentColorFlag) {
+        const auto tc = gce->transparentColorIndex;
+        for(size_t i = 0; i < count; ++i, dst += 4) {
+            if (indices[i] != tc) {
+                auto& color = table[indices[i]];
+                dst[0] = color.r;
+                dst[1] = color.g;
+                dst[2] = color.b;
+                dst[3] = 0xff;
+            }
+        }
+    }
+    else {
+        for(size_t i = 0; i < count; ++i, dst += 4) {
+            auto& color = table[indices[i]];
+            dst[0] = color.r;
+            dst[1] = color.g;
+            dst[2] = color.b;
+            dst[3] = 0xff;
+        }
+    }
+}
+
+/**
+ * \struct  PaintRows
+ * \brief   Row sink that paints decoded rows into a RGBA frame.
+ */
+struct PaintRows
+{
+    void operator()(size_t y, const uint8_t* indices)
+    {
+        expandRow(
+            indices,
+            descriptor.width,
+            palette,
+            gce,
+            frame.rowPointer(descriptor.top + y) + (descriptor.left * 4));
+    }
+
+    const ImageDescriptor& descriptor;
+    const Palette& palette;
+    const GraphicControlExtension* gce;
+    Frame& frame;
+};
+
+/**
+ * \class   Compositor
+ * \brief   Draws the images of a animation onto a canvas in order and applies
+ *          their disposal methods, in the same way as FrameStore::read.
+ */
+class Compositor
+{
+public:
+    Compositor(size_t width, size_t height, const DecodeLimits* limits = nullptr) :
+        canvas_(width, height),
+        saved_(0, 0),
+        limits_(limits),
+        last_{},
+        disposal_(0)
+    {
+        // empty
+    }
+
+    // draws a image, the canvas then holds the displayed frame
+    void draw(
+        std::basic_string_view<uint8_t>::const_iterator data,
+        std::basic_string_view<uint8_t>::const_iterator end,
+        const ImageDescriptor& descriptor,
+        const ColorTable& table,
+        const GraphicControlExtension* gce)
+    {
+        last_ = descriptor;
+        disposal_ = gce ? gce->disposalMethod : 0;
+        if (disposal_ == 3) {
+            saved_ = canvas_;
+        }
+        ParseImageData(data, end, descriptor, canvas_, table, gce, limits_);
+    }
+
+    // disposes of the last drawn image
+    void dispose()
+    {
+        if (disposal_ == 2) {
+            // restore to background
+            for(size_t y = last_.top; y < size_t(last_.top) + last_.height; ++y) {
+                memset(canvas_.rowPointer(y) + last_.left * 4, 0, size_t(last_.width) * 4);
+            }
+        }
+        else if (disposal_ == 3) {
+            // restore to previous
+            canvas_ = saved_;
+        }
+        disposal_ = 0;
+    }
+
+    const Frame& canvas() const { return canvas_; }
+
+private:
+    Frame canvas_;
+    Frame saved_;
+    const DecodeLimits* limits_;
+    ImageDescriptor last_;
+    int disposal_;
+};
+
+// the number of codes decoded between checks of the deadline
+const size_t kCheckInterval = 4096;
+
+/**
+ * \class   ContiguousBitReader
+ * \brief   Reads LZW codes from image data that has been copied out of its
+ *          sub-blocks into a contiguous buffer. The buffer must be padded
+ *          with two bytes, so that a code can be read a word at a time.
+ *          Positions are counted in bits.
+ */
+class ContiguousBitReader
+{
+public:
+    ContiguousBitReader(
+        const uint8_t* data,
+        uint64_t bits,
+        size_t lastBlock,
+        uint64_t position) :
+        data_(data),
+        bits_(bits),
+        lastBlock_(lastBlock),
+        position_(position)
+    {
+        // empty
+    }
+
+    unsigned GetBits(size_t count)
+    {
+        if (position_ + count > bits_) {
+            throw std::runtime_error("Reached null terminator block.");
+        }
+        // a code of at most 12 bits spans at most 3 bytes
+        const uint8_t* p = data_ + (position_ >> 3);
+        const uint32_t word = p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+        position_ += count;
+        return (word >> ((position_ - count) & 7)) & ((1u << count) - 1);
+    }
+
+    // the end of information code must be in the last sub-block, like
+    // BitStream::readDataTerminator expects
+    uint64_t readDataTerminator()
+    {
+        if ((position_ + 7) / 8 <= lastBlock_) {
+            throw std::runtime_error("Expected null terminator block");
+        }
+        return position_;
+    }
+
+    uint64_t skipRemainingBlocks()
+    {
+        position_ = bits_;
+        return position_;
+    }
+
+    uint64_t position() const { return position_; }
+
+private:
+    const uint8_t* data_;
+    uint64_t bits_;
+    size_t lastBlock_;      // byte offset of the data of the last sub-block
+    uint64_t position_;
+};
+
+/**
+ * \class   LzwDecoder
+ * \brief   Decodes the LZW compressed image data of a single image into rows
+ *          of color indices.
+ *
+ *  Every completed row is passed to a row sink, invoked as sink(y, indices),
+ *  where y is relative to the top of the image and indices points to
+ *  width color indices. The rows of a interlaced image are passed in the
+ *  order they are stored, with the y they are shown at. The row buffer is
+ *  reused for the next row. The codes are read from a BitStream, or from a
+ *  ContiguousBitReader.
+ */
+template<typename Input = BitStream>
+class LzwDecoder
+{
+public:
+    using Position = decltype(std::declval<const Input&>().position());
+
+    LzwDecoder(
+        uint8_t minCodeSize,
+        size_t width,
+        size_t height,
+        const Input& input,
+        const DecodeLimits* limits = nullptr) :
+        input_(input),
+        rowBuffer_(width),
+        row_(rowBuffer_.data()),
+        width_(width),
+        height_(width ? height : 0),
+        x_(0),
+        y_(0),
+        index_(0),
+        old_(0),
+        started_(false),
+        done_(false),
+        produced_(0),
+        maxOutput_(UINT64_MAX),
+        deadline_(std::chrono::steady_clock::time_point::max()),
+        checkCountdown_(kCheckInterval),
+        stopRow_(SIZE_MAX),
+        segment_(false),
+        interlaced_(false)
+    {
+        if ((minCodeSize < 1) || (minCodeSize > 8)) {
+            throw std::runtime_error("Invalid LZW minimum code size.");
+        }
+        if (limits) {
+            if (limits->maxFrameOutput) {
+                maxOutput_ = limits->maxFrameOutput;
+            }
+            if (limits->maxTime.count() > 0) {
+                deadline_ = std::chrono::steady_clock::now() + limits->maxTime;
+            }
+        }
+        init(dictionary_, minCodeSize);
+    }
+
+    /**
+     * \brief   Creates a decoder for the codes that follow a clear code, up to
+     *          the next clear code or the end of information code, which
+     *          writes the color indices straight into <output> starting at
+     *          <position>. The segments of the image data between clear codes
+     *          can be decoded independently of each other this way. <output>
+     *          is treated as a single row, indices beyond its end are dropped.
+     */
+    LzwDecoder(
+        uint8_t minCodeSize,
+        std::vector<uint8_t>& output,
+        size_t position,
+        const Input& input) :
+        LzwDecoder(minCodeSize, 0, 0, input)
+    {
+        row_ = output.data();
+        width_ = output.size();
+        if (position < width_) {
+            height_ = 1;
+            x_ = position;
+        }
+        segment_ = true;
+    }
+
+    /**
+     * \brief   Decodes the image data until the end of information code is
+     *          reached. Returns the position of the data following the image.
+     */
+    template<typename RowSink>
+    Position decode(RowSink& sink)
+    {
+        while(!step(sink, SIZE_MAX)) {
+        }
+        return next_;
+    }
+
+    /**
+     * \brief   Decodes at most <maxCodes> codes, returns true once the end of
+     *          information code has been reached. Decoding resumes where it
+     *          left off on the next call.
+     */
+    template<typename RowSink>
+    bool step(RowSink& sink, size_t maxCodes)
+    {
+        auto& dictionary = dictionary_;
+        if (done_) {
+            return true;
+        }
+        if (!started_) {
+            // a segment starts after its clear code
+            if (!segment_ && (input_.GetBits(dictionary.codeLength) != dictionary.clearCode)) {
+                throw std::runtime_error("Expected initial clear code");
+            }
+            started_ = true;
+            if (!readStartIndex(sink)) {
+                return true;
+            }
+        }
+
+        for(size_t count = 0; count < maxCodes; ++count) {
+            if (y_ >= stopRow_) {
+                // the remaining rows aren't needed, skip the rest of the data
+                next_ = input_.skipRemainingBlocks();
+                done_ = true;
+                return true;
+            }
+            if (--checkCountdown_ == 0) {
+                checkDeadline();
+            }
+            index_ = input_.GetBits(dictionary.codeLength);
+            if (index_ < dictionary.currentIndex) { // Does <index> exist in the dictionary?
+                if (index_ == dictionary.eoiCode) {
+                    finish();
+                    return true;
+                }
+                else if (index_ == dictionary.clearCode) {
+                    if (segment_) {
+                        // the next segment starts here
+                        done_ = true;
+                        return true;
+                    }
+                    reset(dictionary);
+                    if (!readStartIndex(sink)) {
+                        return true;
+                    }
+                }
+                else { // code that already exists
+                    output(sink, index_);
+                    add(dictionary, old_, getFirstByte(dictionary, index_));
+                }
+            }
+            else if (index_ == dictionary.currentIndex) {      // <index> does not exist in the dictionary
+                auto b = getFirstByte(dictionary, old_);        // B <- first byte of string at <old>
+                output(sink, add(dictionary, old_, b));
+            }
+            else {
+                throw std::runtime_error("Invalid LZW code.");
+            }
+            // <old> <- <index>
+            old_ = index_;
+        }
+        return false;
+    }
+
+    // the number of pixels decoded so far
+    size_t pixels() const { return (y_ * width_) + x_; }
+
+    // stops the decoding once <row> rows have been completed, the remaining
+    // image data is skipped without being decoded
+    void stopAfter(size_t row) { stopRow_ = row; }
+
+    // passes the rows to the sink with the y they are shown at in a
+    // interlaced image
+    void setInterlaced(bool interlaced) { interlaced_ = interlaced; }
+
+    // replaces the deadline derived from DecodeLimits::maxTime
+    void setDeadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+
+    // the data following the image, valid once the decoding is done
+    Position next() const { return next_; }
+
+private:
+    // reads the first code following a clear code, returns false if the
+    // image data ended instead
+    template<typename RowSink>
+    bool readStartIndex(RowSink& sink)
+    {
+        auto& dictionary = dictionary_;
+        index_ = input_.GetBits(dictionary.codeLength);
+        while(index_ == dictionary.clearCode) {
+            index_ = input_.GetBits(dictionary.codeLength);
+        }
+        if (index_ == dictionary.eoiCode) {
+            finish();
+            return false;
+        }
+        if (index_ > dictionary.clearCode) {
+            throw std::runtime_error("Invalid LZW code following a clear code.");
+        }
+        output(sink, index_);
+        old_ = index_;
+        return true;
+    }
+
+    void finish()
+    {
+        next_ = input_.readDataTerminator();
+        done_ = true;
+    }
+
+    void checkDeadline()
+    {
+        checkCountdown_ = kCheckInterval;
+        if (std::chrono::steady_clock::now() > deadline_) {
+            throw std::runtime_error("Decoding time limit exceeded.");
+        }
+    }
+
+    // writes the string of a dictionary entry at the position of the pen
+    template<typename RowSink>
+    void output(RowSink& sink, size_t index)
+    {
+        produced_ += dictionary_.length[index];
+        if (produced_ > maxOutput_) {
+            throw std::runtime_error("Image data exceeds the output limit.");
+        }
+        if (y_ >= height_) {
+            // ignore any data beyond the last row of the image
+            return;
+        }
+        const size_t length = dictionary_.length[index];
+        if (x_ + length <= width_) {
+            // common case, the whole string fits in the current row
+            extract(index, row_ + x_ + length);
+            x_ += length;
+            if (x_ == width_) {
+                flush(sink);
+            }
+            return;
+        }
+
+        // the string spans several rows
+        extract(index, buffer_.data() + length);
+        const uint8_t* p = buffer_.data();
+        size_t remaining = length;
+        while((remaining > 0) && (y_ < height_)) {
+            const size_t count = std::min(remaining, width_ - x_);
+            memcpy(row_ + x_, p, count);
+            x_ += count;
+            p += count;
+            remaining -= count;
+            if (x_ == width_) {
+                flush(sink);
+            }
+        }
+    }
+
+    // extracts the string of a dictionary entry backwards, ending at <last>
+    inline void extract(size_t index, uint8_t* last)
+    {
+        size_t i = index;
+        while(dictionary_.prefix[i] != -1) {
+            *--last = dictionary_.byteValue[i];
+            i = dictionary_.prefix[i];
+        }
+        *--last = dictionary_.byteValue[i];
+    }
+
+    template<typename RowSink>
+    void flush(RowSink& sink)
+    {
+        sink(interlaced_ ? interlacedRow(y_, height_) : y_, row_);
+        x_ = 0;
+        ++y_;
+    }
+
+    Dictionary dictionary_;
+    Input input_;
+    std::vector<uint8_t> rowBuffer_;
+    uint8_t* row_;
+    std::array<uint8_t, 4096> buffer_;
+    size_t width_;
+    size_t height_;
+    // position of the pen
+    size_t x_;
+    size_t y_;
+    // LZW decoding parameters
+    int16_t index_;
+    int16_t old_;
+    bool started_;
+    bool done_;
+    Position next_;
+    // limits
+    uint64_t produced_;
+    uint64_t maxOutput_;
+    std::chrono::steady_clock::time_point deadline_;
+    size_t checkCountdown_;
+    size_t stopRow_;
+    bool segment_;
+    bool interlaced_;
+};
+
+/**
+ * \class   LzwScanner
+ * \brief   Walks the codes of LZW compressed image data without rebuilding
+ *          the decoded strings. Only the code widths and the string lengths
+ *          of the dictionary are tracked, which is enough to check that every
+ *          code is legal and to count the number of decoded pixels.
+ */
+template<typename Input = BitStream>
+class LzwScanner
+{
+public:
+    using Position = decltype(std::declval<const Input&>().position());
+
+    LzwScanner(
+        uint8_t minCodeSize,
+        const Input& input,
+        const DecodeLimits* limits = nullptr) :
+        input_(input),
+        minCodeSize_(minCodeSize),
+        pixels_(0),
+        maxOutput_(UINT64_MAX),
+        deadline_(std::chrono::steady_clock::time_point::max())
+    {
+        if ((minCodeSize < 1) || (minCodeSize > 8)) {
+            throw std::runtime_error("Invalid LZW minimum code size.");
+        }
+        if (limits) {
+            if (limits->maxFrameOutput) {
+                maxOutput_ = limits->maxFrameOutput;
+            }
+            if (limits->maxTime.count() > 0) {
+                deadline_ = std::chrono::steady_clock::now() + limits->maxTime;
+            }
+        }
+        clearCode_ = 1 << minCodeSize;
+        eoiCode_ = clearCode_ + 1;
+        for(size_t i = 0; i < clearCode_; ++i) {
+            length_[i] = 1;
+        }
+    }
+
+    /**
+     * \brief   Scans the codes up to the end of information code, and returns
+     *          the position of the data following the image.
+     */
+    Position scan()
+    {
+        return scan([](Position, uint64_t) {});
+    }
+
+    /**
+     * \brief   Scans the codes like scan(), and invokes onClear(position,
+     *          pixels) for every clear code, with the position following the
+     *          code and the number of pixels decoded before it.
+     */
+    template<typename ClearSink>
+    Position scan(ClearSink&& onClear)
+    {
+        // the dictionary state is kept in locals, so that it stays in
+        // registers in this loop
+        unsigned codeLength = minCodeSize_ + 1;
+        unsigned currentIndex = clearCode_ + 2;
+        unsigned maxCode = (1 << codeLength) - 1;
+        uint64_t pixels = 0;
+        if (input_.GetBits(codeLength) != clearCode_) {
+            throw std::runtime_error("Expected initial clear code");
+        }
+        onClear(input_.position(), pixels);
+        bool afterClear = true;
+        unsigned old = 0;
+        size_t countdown = kCheckInterval;
+        while(1) {
+            if (--countdown == 0) {
+                checkDeadline();
+                countdown = kCheckInterval;
+            }
+            const unsigned index = input_.GetBits(codeLength);
+            if (index == clearCode_) {
+                codeLength = minCodeSize_ + 1;
+                currentIndex = clearCode_ + 2;
+                maxCode = (1 << codeLength) - 1;
+                afterClear = true;
+                onClear(input_.position(), pixels);
+                continue;
+            }
+            if (index == eoiCode_) {
+                return input_.readDataTerminator();
+            }
+            if (afterClear) {
+                if (index > clearCode_) {
+                    throw std::runtime_error("Invalid LZW code following a clear code.");
+                }
+                afterClear = false;
+            }
+            else if (index <= currentIndex) {
+                // same code width rules as add(Dictionary&, ...)
+                if (currentIndex < 4096) {
+                    if ((currentIndex == maxCode) && (codeLength < 12)) {
+                        ++codeLength;
+                        maxCode = (1 << codeLength) - 1;
+                    }
+                    length_[currentIndex++] = length_[old] + 1;
+                }
+            }
+            else {
+                throw std::runtime_error("Invalid LZW code.");
+            }
+            pixels += length_[index];
+            pixels_ = pixels;
+            if (pixels > maxOutput_) {
+                throw std::runtime_error("Image data exceeds the output limit.");
+            }
+            old = index;
+        }
+    }
+
+    // the number of pixels produced by the codes scanned so far
+    uint64_t pixels() const { return pixels_; }
+
+    // replaces the deadline derived from DecodeLimits::maxTime
+    void setDeadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+
+    // the position of the next code to read
+    Position position() const { return input_.position(); }
+
+private:
+    void checkDeadline() const
+    {
+        if (std::chrono::steady_clock::now() > deadline_) {
+            throw std::runtime_error("Decoding time limit exceeded.");
+        }
+    }
+
+    Input input_;
+    std::array<uint16_t, 4096> length_;
+    unsigned minCodeSize_;
+    unsigned clearCode_;
+    unsigned eoiCode_;
+    uint64_t pixels_;
+    // limits
+    uint64_t maxOutput_;
+    std::chrono::steady_clock::time_point deadline_;
+};
+
+} // namespace detail
+} // namespace gif
+
+#endif // GIF_DECODER_H
@@ -0,0 +1,86 @@
+/**
+ * \file    duplicates.cpp
+ *
+ * \brief   Detection of repeated images by hashing their compressed data.
+ */
+
+#include <gif/gif.h>
+#include "hash.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace gif {
+
+namespace {
+
+// the color table that is used to paint a image
+const ColorTable& colorTable(const FileLayout& layout, const ImageBlock& image)
+{
+    return image.descriptor.localColorTable ? image.localColorTable : layout.globalColorTable;
+}
+
+// the fields of a image that affect its decoded pixels, the delay and the
+// disposal method are left out so that repeated images with different
+// timing are still detected
+std::array<uint8_t, 12> pixelFields(const ImageBlock& image)
+{
+    const auto& d = image.descriptor;
+    const bool transparent = image.hasGraphicControl && image.gce.transparentColorFlag;
+    return {
+        static_cast<uint8_t>(d.left), static_cast<uint8_t>(d.left >> 8),
+        static_cast<uint8_t>(d.top), static_cast<uint8_t>(d.top >> 8),
+        static_cast<uint8_t>(d.width), static_cast<uint8_t>(d.width >> 8),
+        static_cast<uint8_t>(d.height), static_cast<uint8_t>(d.height >> 8),
+        static_cast<uint8_t>(d.interlaced),
+        static_cast<uint8_t>(transparent),
+        static_cast<uint8_t>(transparent ? image.gce.transparentColorIndex : 0),
+        0
+    };
+}
+
+bool identical(const FileLayout& layout, const ImageBlock& a, const ImageBlock& b)
+{
+    const auto& ta = colorTable(layout, a);
+    const auto& tb = colorTable(layout, b);
+    return (pixelFields(a) == pixelFields(b)) &&
+        (ta.size() == tb.size()) &&
+        std::equal(ta.begin(), ta.end(), tb.begin(), [](const Color& x, const Color& y) {
+            return (x.r == y.r) && (x.g == y.g) && (x.b == y.b);
+        }) &&
+        std::equal(a.data, a.next, b.data, b.next);
+}
+
+} // namespace
+
+std::vector<size_t> FindDuplicateImages(const FileLayout& layout)
+{
+    std::vector<size_t> result(layout.images.size());
+    std::unordered_multimap<uint64_t, size_t> seen;
+    for(size_t i = 0; i < layout.images.size(); ++i) {
+        const auto& image = layout.images[i];
+        const auto fields = pixelFields(image);
+        const auto& table = colorTable(layout, image);
+        uint64_t h = detail::hash(fields.data(), fields.size());
+        for(const auto& color : table) {
+            const uint8_t rgb[3] = {color.r, color.g, color.b};
+            h = detail::hash(rgb, 3, h);
+        }
+        h = detail::hash(&*image.data, image.next - image.data, h);
+
+        result[i] = i;
+        // compare the candidates byte by byte to rule out hash collisions
+        auto range = seen.equal_range(h);
+        for(auto it = range.first; it != range.second; ++it) {
+            if (identical(layout, layout.images[it->second], image)) {
+                result[i] = it->second;
+                break;
+            }
+        }
+        if (result[i] == i) {
+            seen.emplace(h, i);
+        }
+    }
+    return result;
+}
+
+} // namespace gif
@@ -0,0 +1,381 @@
+/**
+ * \file    frame_store.cpp
+ */
+
+#include <gif/frame_store.h>
+#include "decoder.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace gif {
+
+namespace {
+
+// run-length encodes <data> using the PackBits scheme: a control byte c < 128
+// is followed by c + 1 literal bytes, a control byte c >= 128 is followed by a
+// single byte that is repeated c - 125 times.
+std::vector<uint8_t> compress(const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> result;
+    size_t i = 0;
+    while(i < data.size()) {
+        // measure the run starting at i
+        size_t run = 1;
+        while((i + run < data.size()) && (run < 130) && (data[i + run] == data[i])) {
+            ++run;
+        }
+        if (run >= 3) {
+            result.push_back(static_cast<uint8_t>(run + 125));
+            result.push_back(data[i]);
+            i += run;
+            continue;
+        }
+        // collect literals until the next run of three or more bytes
+        size_t literals = 0;
+        while((i + literals < data.size()) && (literals < 128)) {
+            const size_t j = i + literals;
+            if ((j + 2 < data.size()) && (data[j] == data[j + 1]) && (data[j] == data[j + 2])) {
+                break;
+            }
+            ++literals;
+        }
+        result.push_back(static_cast<uint8_t>(literals - 1));
+        result.insert(result.end(), data.begin() + i, data.begin() + i + literals);
+        i += literals;
+    }
+    return result;
+}
+
+void decompress(const std::vector<uint8_t>& data, uint8_t* dst, size_t size)
+{
+    const uint8_t* end = dst + size;
+    size_t i = 0;
+    while((i < data.size()) && (dst < end)) {
+        const uint8_t control = data[i++];
+        if (control < 128) {
+            const size_t count = std::min<size_t>(control + 1, end - dst);
+            memcpy(dst, &data[i], count);
+            i += control + 1;
+            dst += count;
+        }
+        else {
+            const size_t count = std::min<size_t>(control - 125, end - dst);
+            memset(dst, data[i++], count);
+            dst += count;
+        }
+    }
+}
+
+} // namespace
+
+FrameStore::FrameStore(
+    const LogicalScreenDescriptor& screen,
+    bool compress,
+    size_t checkpointInterval) :
+    screen_(screen),
+    compress_(compress),
+    checkpointInterval_(checkpointInterval)
+{
+    // empty
+}
+
+std::basic_string_view<uint8_t>::const_iterator FrameStore::add(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const ImageDescriptor& descriptor,
+    const ColorTable& table,
+    const GraphicControlExtension* gce,
+    const DecodeLimits* limits)
+{
+    std::vector<uint8_t> indices;
+    auto next = ParseImageIndices(it, end, descriptor, indices, limits);
+    add(descriptor, table, gce, indices);
+    return next;
+}
+
+void FrameStore::add(
+    const ImageDescriptor& descriptor,
+    const ColorTable& table,
+    const GraphicControlExtension* gce,
+    const std::vector<uint8_t>& indices)
+{
+    if (indices.size() != size_t(descriptor.width) * descriptor.height) {
+        throw std::runtime_error("The color indices don't match the image descriptor.");
+    }
+
+    StoredFrame frame;
+    frame.descriptor = descriptor;
+    frame.hasGraphicControl = (gce != nullptr);
+    frame.gce = gce ? *gce : GraphicControlExtension{};
+    frame.palette = addPalette(table);
+    frame.compressed = false;
+    frame.keyFrame = frames_.size();
+    frame.original = frames_.size();
+    frame.checkpointCompressed = false;
+
+    // the fields that affect the pixels of the frame, the delay and the
+    // disposal method don't
+    const bool transparent = gce && gce->transparentColorFlag;
+    const uint64_t fields[] = {
+        descriptor.left, descriptor.top, descriptor.width, descriptor.height,
+        frame.palette,
+        transparent ? (0x100u | gce->transparentColorIndex) : 0u
+    };
+    const uint64_t h = detail::hash(indices.data(), indices.size(),
+        detail::hash(reinterpret_cast<const uint8_t*>(fields), sizeof(fields)));
+    auto range = images_.equal_range(h);
+    for(auto it = range.first; it != range.second; ++it) {
+        if (repeats(frame, frames_[it->second], indices)) {
+            addDuplicate(it->second, gce);
+            return;
+        }
+    }
+    images_.emplace(h, frames_.size());
+
+    std::vector<uint8_t> data;
+    if (compress_) {
+        data = compress(indices);
+        frame.compressed = (data.size() < indices.size());
+    }
+    if (!frame.compressed) {
+        data = indices;
+    }
+    data.shrink_to_fit();
+    frame.data = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+
+    append(std::move(frame));
+}
+
+void FrameStore::addDuplicate(
+    size_t index,
+    const GraphicControlExtension* gce)
+{
+    StoredFrame frame = frames_.at(index);
+    frame.hasGraphicControl = (gce != nullptr);
+    frame.gce = gce ? *gce : GraphicControlExtension{};
+    append(std::move(frame));
+}
+
+void FrameStore::append(StoredFrame frame)
+{
+    // a frame that paints every pixel of the canvas doesn't depend on any
+    // of the previous frames, unless disposing it restores them, and neither
+    // does a frame that follows a frame that cleared the whole canvas.
+    const auto& descriptor = frame.descriptor;
+    const bool coversCanvas =
+        (descriptor.left == 0) && (descriptor.top == 0) &&
+        (descriptor.width >= screen_.width) &&
+        (descriptor.height >= screen_.height);
+    const bool opaque = !(frame.hasGraphicControl && frame.gce.transparentColorFlag);
+    const bool restoresPrevious = frame.hasGraphicControl && (frame.gce.disposalMethod == 3);
+    frame.keyFrame = frames_.size();
+    frame.checkpoint.reset();
+    frame.checkpointCompressed = false;
+    if (!frames_.empty() && !(coversCanvas && opaque && !restoresPrevious)) {
+        auto& previous = frames_.back();
+        const auto& pd = previous.descriptor;
+        const bool clearedCanvas =
+            previous.hasGraphicControl && (previous.gce.disposalMethod == 2) &&
+            (pd.left == 0) && (pd.top == 0) &&
+            (pd.width >= screen_.width) && (pd.height >= screen_.height);
+        if (!clearedCanvas) {
+            frame.keyFrame = previous.keyFrame;
+        }
+    }
+
+    if (checkpointInterval_ && (frames_.size() - frame.keyFrame >= checkpointInterval_)) {
+        // store the canvas that the frame is drawn on
+        Frame canvas(screen_.width, screen_.height);
+        composite(frames_.size() - 1, canvas, true);
+        std::vector<uint8_t> data;
+        if (compress_) {
+            data = compress(canvas.pixels);
+            frame.checkpointCompressed = (data.size() < canvas.pixels.size());
+        }
+        if (!frame.checkpointCompressed) {
+            data = std::move(canvas.pixels);
+        }
+        data.shrink_to_fit();
+        frame.checkpoint = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+        frame.keyFrame = frames_.size();
+    }
+
+    frames_.push_back(std::move(frame));
+}
+
+// compares a frame with a earlier frame that owns its data, byte by byte to
+// rule out hash collisions
+bool FrameStore::repeats(
+    const StoredFrame& frame,
+    const StoredFrame& original,
+    const std::vector<uint8_t>& indices) const
+{
+    const auto& a = frame.descriptor;
+    const auto& b = original.descriptor;
+    const bool transparent = frame.hasGraphicControl && frame.gce.transparentColorFlag;
+    if ((a.left != b.left) || (a.top != b.top) || (a.width != b.width) || (a.height != b.height) ||
+        (frame.palette != original.palette) ||
+        (transparent != (original.hasGraphicControl && original.gce.transparentColorFlag)) ||
+        (transparent && (frame.gce.transparentColorIndex != original.gce.transparentColorIndex)))
+    {
+        return false;
+    }
+    if (!original.compressed) {
+        return *original.data == indices;
+    }
+    std::vector<uint8_t> unpacked(indices.size());
+    decompress(*original.data, unpacked.data(), unpacked.size());
+    return unpacked == indices;
+}
+
+size_t FrameStore::addPalette(const ColorTable& table)
+{
+    // most animations share a single global color table between all frames
+    for(size_t i = palettes_.size(); i > 0; --i) {
+        if (palettes_[i - 1].size() != table.size()) {
+            continue;
+        }
+        if (std::equal(table.begin(), table.end(), palettes_[i - 1].begin(),
+            [](const Color& a, const Color& b) {
+                return (a.r == b.r) && (a.g == b.g) && (a.b == b.b);
+            }))
+        {
+            return i - 1;
+        }
+    }
+    palettes_.push_back(table);
+    return palettes_.size() - 1;
+}
+
+void FrameStore::read(size_t index, Frame& canvas) const
+{
+    if (index >= frames_.size()) {
+        throw std::out_of_range("Invalid frame index.");
+    }
+    if ((canvas.width != screen_.width) || (canvas.height != screen_.height)) {
+        throw std::runtime_error("The canvas doesn't match the logical screen.");
+    }
+    composite(index, canvas, false);
+}
+
+// composites the frames from the key frame of <index> up to <index>, and if
+// <dispose> is set also applies the disposal method of <index>
+void FrameStore::composite(size_t index, Frame& canvas, bool dispose) const
+{
+    const StoredFrame& start = frames_[frames_[index].keyFrame];
+    if (!start.checkpoint) {
+        std::fill(canvas.pixels.begin(), canvas.pixels.end(), 0);
+    }
+    else if (start.checkpointCompressed) {
+        decompress(*start.checkpoint, canvas.pixels.data(), canvas.pixels.size());
+    }
+    else {
+        canvas.pixels = *start.checkpoint;
+    }
+
+    std::vector<uint8_t> saved;
+    for(size_t i = frames_[index].keyFrame; i <= index; ++i) {
+        const StoredFrame& frame = frames_[i];
+        const auto& d = frame.descriptor;
+        const size_t left = std::min<size_t>(d.left, canvas.width);
+        const size_t right = std::min<size_t>(left + d.width, canvas.width);
+        const size_t top = std::min<size_t>(d.top, canvas.height);
+        const size_t bottom = std::min<size_t>(top + d.height, canvas.height);
+        const size_t rowBytes = (right - left) * 4;
+        const int disposal = frame.hasGraphicControl ? frame.gce.disposalMethod : 0;
+        const bool last = (i == index);
+
+        if ((!last || dispose) && (disposal == 3)) {
+            // save the area so that it can be restored once the frame is disposed
+            saved.resize(rowBytes * (bottom - top));
+            for(size_t y = top; y < bottom; ++y) {
+                memcpy(&saved[(y - top) * rowBytes], canvas.rowPointer(y) + left * 4, rowBytes);
+            }
+        }
+
+        draw(frame, canvas);
+        if (last && !dispose) {
+            break;
+        }
+
+        if (disposal == 2) {
+            // restore to background
+            for(size_t y = top; y < bottom; ++y) {
+                memset(canvas.rowPointer(y) + left * 4, 0, rowBytes);
+            }
+        }
+        else if (disposal == 3) {
+            // restore to previous
+            for(size_t y = top; y < bottom; ++y) {
+                memcpy(canvas.rowPointer(y) + left * 4, &saved[(y - top) * rowBytes], rowBytes);
+            }
+        }
+    }
+}
+
+void FrameStore::draw(const StoredFrame& frame, Frame& canvas) const
+{
+    const auto& d = frame.descriptor;
+    const size_t size = size_t(d.width) * d.height;
+    std::vector<uint8_t> unpacked;
+    const uint8_t* indices = frame.data->data();
+    if (frame.compressed) {
+        unpacked.resize(size);
+        decompress(*frame.data, unpacked.data(), size);
+        indices = unpacked.data();
+    }
+
+    if ((d.left >= canvas.width) || (d.top >= canvas.height)) {
+        return;
+    }
+    const size_t width = std::min<size_t>(d.width, canvas.width - d.left);
+    const size_t height = std::min<size_t>(d.height, canvas.height - d.top);
+    const detail::Palette palette(palettes_[frame.palette]);
+    const GraphicControlExtension* gce = frame.hasGraphicControl ? &frame.gce : nullptr;
+    for(size_t y = 0; y < height; ++y) {
+        detail::expandRow(
+            indices + (y * d.width),
+            width,
+            palette,
+            gce,
+            canvas.rowPointer(d.top + y) + (d.left * 4));
+    }
+}
+
+size_t FrameStore::memoryUsage() const
+{
+    size_t result = frames_.capacity() * sizeof(StoredFrame);
+    for(size_t i = 0; i < frames_.size(); ++i) {
+        // duplicates share the data of the original frame
+        if (frames_[i].original == i) {
+            result += frames_[i].data->capacity();
+        }
+        if (frames_[i].checkpoint) {
+            result += frames_[i].checkpoint->capacity();
+        }
+    }
+    for(auto& palette : palettes_) {
+        result += palette.capacity() * sizeof(Color);
+    }
+    return result;
+}
+
+const ImageDescriptor& FrameStore::descriptor(size_t index) const
+{
+    return frames_.at(index).descriptor;
+}
+
+size_t FrameStore::duplicateOf(size_t index) const
+{
+    return frames_.at(index).original;
+}
+
+const GraphicControlExtension* FrameStore::graphicControl(size_t index) const
+{
+    auto& frame = frames_.at(index);
+    return frame.hasGraphicControl ? &frame.gce : nullptr;
+}
+
+} // namespace gif
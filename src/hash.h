@@ -0,0 +1,49 @@
+/**
+ * \file    hash.h
+ *
+ * \brief   Internal non-cryptographic hashing of byte ranges.
+ */
+
+#ifndef GIF_HASH_H
+#define GIF_HASH_H
+
+#include <stdint.h>
+#include <cstring>
+#include <stddef.h>
+
+namespace gif {
+namespace detail {
+
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * \brief   Hashes a range of bytes, eight bytes at a time. Pass the result
+ *          as the seed of the next call to hash several ranges.
+ */
+inline uint64_t hash(const uint8_t* data, size_t size, uint64_t seed = 0)
+{
+    uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ULL);
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    h = (h ^ mix(tail)) * 0x9e3779b97f4a7c15ULL;
+    return mix(h);
+}
+
+} // namespace detail
+} // namespace gif
+
+#endif // GIF_HASH_H
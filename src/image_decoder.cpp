@@ -0,0 +1,137 @@
+/**
+ * \file    image_decoder.cpp
+ */
+
+#include <gif/image_decoder.h>
+#include <gif/bit_stream.h>
+#include "decoder.h"
+
+namespace gif {
+
+namespace {
+
+// the number of codes decoded between checks of the pixel and time budgets
+const size_t kCheckInterval = 64;
+
+} // namespace
+
+struct ImageDecoder::Impl
+{
+    Impl(
+        uint8_t minCodeSize,
+        std::basic_string_view<uint8_t>::const_iterator it,
+        std::basic_string_view<uint8_t>::const_iterator end,
+        const ImageDescriptor& imageDescriptor,
+        Frame& framebuffer,
+        const ColorTable& table,
+        const GraphicControlExtension* graphicControl,
+        const DecodeLimits* limits) :
+        descriptor(imageDescriptor),
+        palette(table),
+        gce(graphicControl ? *graphicControl : GraphicControlExtension{}),
+        sink{descriptor, palette, graphicControl ? &gce : nullptr, framebuffer},
+        decoder(minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits),
+        complete(false),
+        timeLimited(limits && (limits->maxTime.count() > 0)),
+        remainingTime(timeLimited ? limits->maxTime : std::chrono::milliseconds(0))
+    {
+        decoder.setInterlaced(descriptor.interlaced);
+    }
+
+    DecodeStatus decode(const DecodeBudget& budget, std::chrono::steady_clock::time_point start);
+
+    const ImageDescriptor descriptor;
+    const detail::Palette palette;
+    const GraphicControlExtension gce;
+    detail::PaintRows sink;
+    detail::LzwDecoder<> decoder;
+    bool complete;
+    // the time limit only counts the time spent in decode()
+    const bool timeLimited;
+    std::chrono::steady_clock::duration remainingTime;
+};
+
+DecodeStatus ImageDecoder::Impl::decode(
+    const DecodeBudget& budget,
+    std::chrono::steady_clock::time_point start)
+{
+    if (!budget.pixels && (budget.time.count() == 0)) {
+        // only the number of codes is limited
+        complete = decoder.step(sink, budget.codes ? budget.codes : SIZE_MAX);
+        return complete ? DecodeStatus::kComplete : DecodeStatus::kInProgress;
+    }
+
+    const size_t startPixels = decoder.pixels();
+    size_t codes = budget.codes ? budget.codes : SIZE_MAX;
+    while(codes > 0) {
+        const size_t count = std::min(codes, kCheckInterval);
+        if (decoder.step(sink, count)) {
+            complete = true;
+            return DecodeStatus::kComplete;
+        }
+        codes -= count;
+        if (budget.pixels && (decoder.pixels() - startPixels >= budget.pixels)) {
+            break;
+        }
+        if ((budget.time.count() > 0) && (std::chrono::steady_clock::now() - start >= budget.time)) {
+            break;
+        }
+    }
+    return DecodeStatus::kInProgress;
+}
+
+ImageDecoder::ImageDecoder(
+    std::basic_string_view<uint8_t>::const_iterator it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const ImageDescriptor& descriptor,
+    Frame& frame,
+    const ColorTable& table,
+    const GraphicControlExtension* gce,
+    const DecodeLimits* limits)
+{
+    detail::checkBounds(descriptor, frame);
+    detail::checkLimits(descriptor, limits);
+    const uint8_t minCodeSize = ParseByte(it, end);
+    impl_ = std::make_unique<Impl>(
+        minCodeSize, it, end, descriptor, frame, table, gce, limits);
+}
+
+ImageDecoder::~ImageDecoder()
+{
+    // empty
+}
+
+DecodeStatus ImageDecoder::decode(const DecodeBudget& budget)
+{
+    auto& impl = *impl_;
+    if (impl.complete) {
+        return DecodeStatus::kComplete;
+    }
+
+    // the deadline of the LZW decoder is moved by the time spent outside
+    // of decode()
+    const auto start = std::chrono::steady_clock::now();
+    if (impl.timeLimited) {
+        impl.decoder.setDeadline(start + impl.remainingTime);
+    }
+    const DecodeStatus status = impl.decode(budget, start);
+    if (impl.timeLimited) {
+        impl.remainingTime -= std::chrono::steady_clock::now() - start;
+    }
+    return status;
+}
+
+size_t ImageDecoder::decodedPixels() const
+{
+    return impl_->decoder.pixels();
+}
+
+std::basic_string_view<uint8_t>::const_iterator ImageDecoder::next() const
+{
+    if (!impl_->complete) {
+        throw std::logic_error("The image hasn't been completely decoded.");
+    }
+    return impl_->decoder.next();
+}
+
+} // namespace gif
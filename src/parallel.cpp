@@ -0,0 +1,184 @@
+/**
+ * \file    parallel.cpp
+ *
+ * \brief   Decoding of a single image on several threads. Every clear code
+ *          resets the LZW dictionary, so the segments of the image data
+ *          between clear codes can be decoded independently of each other.
+ */
+
+#include <gif/gif.h>
+#include "decoder.h"
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace gif {
+
+namespace {
+
+/**
+ * \struct  ImageData
+ * \brief   LZW compressed image data copied out of its sub-blocks into a
+ *          contiguous buffer.
+ */
+struct ImageData
+{
+    std::vector<uint8_t> bytes;     // padded, so that codes can be read a word at a time
+    uint64_t bits;                  // the number of valid bits
+    size_t lastBlock;               // offset of the data of the last sub-block
+};
+
+/**
+ * \struct  Segment
+ * \brief   The codes following a clear code, up to the next clear code or the
+ *          end of information code.
+ */
+struct Segment
+{
+    uint64_t bit;       // position of the first code after the clear code
+    uint64_t pixel;     // position of the first decoded pixel
+};
+
+ImageData readImageData(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end)
+{
+    ImageData data{std::vector<uint8_t>(), 0, 0};
+    while(const uint8_t size = ParseByte(it, end)) {
+        if (static_cast<size_t>(end - it) < size) {
+            throw std::runtime_error(
+                "Reached EOF, can't read any more bytes from input.");
+        }
+        data.lastBlock = data.bytes.size();
+        data.bytes.insert(data.bytes.end(), it, it + size);
+        it += size;
+    }
+    data.bits = uint64_t(data.bytes.size()) * 8;
+    data.bytes.resize(data.bytes.size() + 3, 0);
+    return data;
+}
+
+detail::ContiguousBitReader reader(const ImageData& data, uint64_t position)
+{
+    return detail::ContiguousBitReader(data.bytes.data(), data.bits, data.lastBlock, position);
+}
+
+// runs <task> on <count> threads, one of them being the calling thread, and
+// rethrows the first exception thrown by any of them
+template<typename Task>
+void runOnThreads(size_t count, const Task& task)
+{
+    std::mutex mutex;
+    std::exception_ptr error;
+    auto run = [&](size_t thread) {
+        try {
+            task(thread);
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try {
+        for(size_t i = 1; i < count; ++i) {
+            threads.emplace_back(run, i);
+        }
+    }
+    catch(...) {
+        // a thread couldn't be started, wait for the ones that were
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        throw;
+    }
+    run(0);
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace
+
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataParallel(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t threads,
+    const DecodeLimits* limits)
+{
+    detail::checkBounds(descriptor, frame);
+    detail::checkLimits(descriptor, limits);
+    if (threads == 0) {
+        threads = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    }
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (limits && (limits->maxTime.count() > 0)) {
+        deadline = std::chrono::steady_clock::now() + limits->maxTime;
+    }
+
+    const uint8_t minCodeSize = ParseByte(it, end);
+    if ((minCodeSize < 1) || (minCodeSize > 8)) {
+        throw std::runtime_error("Invalid LZW minimum code size.");
+    }
+    const ImageData data = readImageData(it, end);
+
+    // first pass, find the clear codes
+    std::vector<Segment> segments;
+    detail::LzwScanner scanner(minCodeSize, reader(data, 0), limits);
+    scanner.setDeadline(deadline);
+    scanner.scan([&](uint64_t bit, uint64_t pixel) {
+        if (!segments.empty() && (segments.back().pixel == pixel)) {
+            // repeated clear codes don't start a new segment
+            segments.back().bit = bit;
+        }
+        else {
+            segments.push_back(Segment{bit, pixel});
+        }
+    });
+    const uint64_t total = scanner.pixels();
+
+    // second pass, decode the segments into color indices
+    std::vector<uint8_t> indices(size_t(descriptor.width) * descriptor.height, 0);
+    std::atomic<size_t> nextSegment(0);
+    runOnThreads(std::min(threads, segments.size()), [&](size_t) {
+        auto ignore = [](size_t, const uint8_t*) {};
+        for(size_t i = nextSegment++; i < segments.size(); i = nextSegment++) {
+            detail::LzwDecoder decoder(minCodeSize, indices, segments[i].pixel, reader(data, segments[i].bit));
+            decoder.setDeadline(deadline);
+            decoder.decode(ignore);
+        }
+    });
+
+    // expand the rows, data that ends early leaves the remaining pixels of
+    // the frame untouched
+    const detail::Palette palette(table);
+    const size_t pixels = std::min<uint64_t>(total, indices.size());
+    const size_t rows = (pixels + descriptor.width - 1) / std::max<size_t>(descriptor.width, 1);
+    const size_t count = std::max<size_t>(std::min<size_t>(threads, rows), 1);
+    runOnThreads(count, [&](size_t thread) {
+        for(size_t y = (thread * rows) / count; y < ((thread + 1) * rows) / count; ++y) {
+            const size_t row = descriptor.interlaced ?
+                detail::interlacedRow(y, descriptor.height) : y;
+            detail::expandRow(
+                &indices[y * descriptor.width],
+                std::min<size_t>(descriptor.width, pixels - (y * descriptor.width)),
+                palette,
+                gce,
+                frame.rowPointer(descriptor.top + row) + (descriptor.left * 4));
+        }
+    });
+    return it;
+}
+
+} // namespace gif
@@ -6,7 +6,10 @@
 
 #include <gif/gif.h>
 #include <gif/bit_stream.h>
+#include "decoder.h"
 #include <iostream>
+#include <cstring>
+#include <stdexcept>
 
 namespace gif {
 
@@ -53,6 +56,20 @@ std::string ParseString(
     return result;
 }
 
+void SkipSubBlocks(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end)
+{
+    uint8_t blockSize = ParseByte(it, end);
+    while(blockSize > 0) {
+        if (static_cast<size_t>(end - it) < blockSize) {
+            throw std::runtime_error("Data sub-block exceeds the end of the stream.");
+        }
+        it = it + blockSize;
+        blockSize = ParseByte(it, end);
+    }
+}
+
 Version ParseHeader(
     std::basic_string_view<uint8_t>::const_iterator& it,
     std::basic_string_view<uint8_t>::const_iterator end)
@@ -180,193 +197,197 @@ ApplicationExtension ParseApplicationExtension(
     for(size_t i = 0; i < result.code.size(); ++i) {
         result.code[i] = ParseByte(it, end);
     }
-    // for each application data block
-    uint8_t blockSize = ParseByte(it, end);
-    while(blockSize > 0) {
-        // skip the application data
-        it = it + blockSize;
-        blockSize = ParseByte(it, end);
-    }
+    // skip the application data blocks
+    SkipSubBlocks(it, end);
     return result;
 }
 
-/*****************************************************************************/
-/*                                Image decoding                             */
-/*****************************************************************************/
-namespace {
-
-struct Dictionary
-{
-    std::array<int16_t, 4096> prefix;
-    std::array<int16_t, 4096> length;
-    std::array<uint8_t, 4096> byteValue;
-    uint16_t minCodeSize;
-    uint16_t codeLength;
-    uint16_t clearCode;
-    uint16_t eoiCode;
-    uint16_t currentIndex;
-    uint16_t maxCode;
-};
-
-// resets a dictionary
-void reset(Dictionary& dictionary)
+FileLayout ParseFileLayout(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const DecodeLimits* limits)
 {
-    const size_t dictionarySize = (1 << dictionary.minCodeSize);
-    dictionary.codeLength = dictionary.minCodeSize + 1;
-    dictionary.clearCode = dictionarySize;
-    dictionary.eoiCode = dictionary.clearCode + 1;
-    dictionary.currentIndex = dictionary.clearCode + 2;
-    dictionary.maxCode = (1 << dictionary.codeLength) - 1;
-}
+    const auto start = std::chrono::steady_clock::now();
+    const DecodeLimits none;
+    if (!limits) {
+        limits = &none;
+    }
 
-// initializes a dictionary with the initial values
-void init(Dictionary& dictionary, size_t minCodeSize)
-{
-    dictionary.minCodeSize = minCodeSize;
-    size_t dictionarySize = (1 << minCodeSize);
-    for(size_t i = 0; i < dictionarySize; i++) {
-        dictionary.prefix[i] = -1;
-        dictionary.byteValue[i] = static_cast<uint8_t>(i);
-        dictionary.length[i] = 1;
+    FileLayout layout;
+    layout.version = ParseHeader(it, end);
+    layout.screen = ParseLogicalScreenDescriptor(it, end);
+    if (limits->maxCanvasPixels &&
+        (uint64_t(layout.screen.width) * layout.screen.height > limits->maxCanvasPixels))
+    {
+        throw std::runtime_error("Logical screen exceeds the canvas pixel limit.");
+    }
+    if (layout.screen.globalColorTable) {
+        ParseColorTable(
+            layout.globalColorTable,
+            1 << (layout.screen.globalColorTableSize + 1),
+            it,
+            end);
     }
-    reset(dictionary);
-}
 
-inline size_t add(Dictionary& dictionary, int prefix, uint8_t byteValue)
-{
-    auto& ci = dictionary.currentIndex;
-    if (ci < 4096) {
-        if ((ci == dictionary.maxCode) && (dictionary.codeLength < 12)) {
-            ++dictionary.codeLength;
-            dictionary.maxCode = (1 << dictionary.codeLength) - 1;
+    GraphicControlExtension gce{};
+    bool hasGraphicControl = false;
+    uint64_t totalPixels = 0;
+    while(1) {
+        if ((limits->maxTime.count() > 0) &&
+            (std::chrono::steady_clock::now() - start > limits->maxTime))
+        {
+            throw std::runtime_error("Parsing time limit exceeded.");
+        }
+        switch(PeekByte(it, end))
+        {
+        case 0x21:
+            {
+                ++it;   // consume the extension introducer
+                switch(PeekByte(it, end)) {
+                case 0xF9:
+                    gce = ParseGraphicControlExtension(it, end);
+                    hasGraphicControl = true;
+                    break;
+                case 0xFF:
+                    ParseApplicationExtension(it, end);
+                    break;
+                default:
+                    // comment, plain text and unknown extensions
+                    ++it;
+                    SkipSubBlocks(it, end);
+                    break;
+                }
+                break;
+            }
+        case 0x2c:
+            {
+                if (limits->maxFrames && (layout.images.size() >= limits->maxFrames)) {
+                    throw std::runtime_error("File exceeds the frame limit.");
+                }
+                ImageBlock image;
+                image.descriptor = ParseImageDescriptor(it, end);
+                detail::checkLimits(image.descriptor, limits);
+                totalPixels += uint64_t(image.descriptor.width) * image.descriptor.height;
+                if (limits->maxTotalPixels && (totalPixels > limits->maxTotalPixels)) {
+                    throw std::runtime_error("File exceeds the total pixel limit.");
+                }
+                if (image.descriptor.localColorTable) {
+                    ParseColorTable(
+                        image.localColorTable,
+                        1 << (image.descriptor.localColorTableSize + 1),
+                        it,
+                        end);
+                }
+                image.gce = gce;
+                image.hasGraphicControl = hasGraphicControl;
+                image.data = it;
+                ParseByte(it, end);     // LZW minimum code size
+                SkipSubBlocks(it, end);
+                image.next = it;
+                layout.images.push_back(std::move(image));
+                // a graphic control extension only applies to the next image
+                hasGraphicControl = false;
+                break;
+            }
+        case 0x3b:
+            ++it;
+            return layout;
+        default:
+            throw std::runtime_error("Unexpected block introducer.");
         }
-        dictionary.prefix[ci] = prefix;
-        dictionary.byteValue[ci] = byteValue;
-        dictionary.length[ci] = ((prefix < 0) ? 0 : dictionary.length[prefix]) + 1;
-        // return the index where the entry was inserted
-        return ci++;
     }
-    return ci;
 }
 
-// get the first byte associated with a dictionary entry
-inline uint8_t getFirstByte(
-    Dictionary& dictionary,
-    size_t index)
+/*****************************************************************************/
+/*                                Image decoding                             */
+/*****************************************************************************/
+namespace {
+
+/**
+ * \struct  StoreRows
+ * \brief   Row sink that stores the decoded color indices.
+ */
+struct StoreRows
 {
-    size_t i = index;
-    while(dictionary.prefix[i] != -1) {
-        i = dictionary.prefix[i];
+    void operator()(size_t y, const uint8_t* indices)
+    {
+        memcpy(&result[y * width], indices, width);
     }
-    return dictionary.byteValue[i];
-}
+
+    std::vector<uint8_t>& result;
+    size_t width;
+};
 
 /**
- * \struct  DecodeState
+ * \struct  RegionRows
+ * \brief   Row sink that paints the part of the decoded rows that is inside
+ *          a region of the frame.
  */
-struct DecodeState
+struct RegionRows
 {
-    DecodeState(
-        uint8_t minCodeSize,
-        const gif::ImageDescriptor& imageDescriptor,
-        const gif::ColorTable& table,
-        const GraphicControlExtension* graphicControl,
-        Frame& framebuffer) :
-        descriptor(imageDescriptor),
-        colorTable(table),
-        gce(graphicControl),
-        frame(framebuffer),
-        index(0),
-        old(0),
-        px(descriptor.left),
-        py(descriptor.top)
+    void operator()(size_t y, const uint8_t* indices)
     {
-        init(dictionary, minCodeSize);
-        // extract the image rectangle
-        left = descriptor.left;
-        right = left + descriptor.width;
-        top = descriptor.top;
-        bottom = top + descriptor.height;
+        const size_t row = top + y;
+        if ((row >= regionTop) && (row < regionBottom)) {
+            detail::expandRow(
+                indices + (regionLeft - left),
+                regionRight - regionLeft,
+                palette,
+                gce,
+                frame.rowPointer(row) + (regionLeft * 4));
+        }
     }
 
-    const ImageDescriptor& descriptor;
-    const gif::ColorTable& colorTable;
+    const detail::Palette& palette;
     const GraphicControlExtension* gce;
     Frame& frame;
-    Dictionary dictionary;
-
-    // LZW decoding parameters
-    int16_t index;
-    int16_t old;
-    // painting parameters
-    size_t px;  // X position of pen
-    size_t py;  // Y position of pen
-    // image coordinates
     size_t left;
-    size_t right;
     size_t top;
-    size_t bottom;
+    // the intersection of the region and the image
+    size_t regionLeft;
+    size_t regionRight;
+    size_t regionTop;
+    size_t regionBottom;
 };
 
-inline void paint(
-    DecodeState& state,
-    size_t index)
+/**
+ * \struct  BandRows
+ * \brief   Row sink that collects decoded rows into bands.
+ */
+struct BandRows
 {
-    auto& dictionary = state.dictionary;
-    auto length = dictionary.length[index];
-    std::array<uint8_t, 4096> buffer;
-    // extract the indicies
-    size_t bufferIndex = length - 1;
-    size_t i = index;
-    while(dictionary.prefix[i] != -1) {
-        buffer[bufferIndex] = dictionary.byteValue[i];
-        i = dictionary.prefix[i];
-        --bufferIndex;
-    }
-    buffer[bufferIndex] = dictionary.byteValue[i];
-
-    // check if a background color has been specified for this frame
-    auto& framebuffer = state.frame;
-    if (state.gce && state.gce->transparentColorFlag) {
-        // ignore transparent color index when painting
-        auto tc = state.gce->transparentColorIndex;
-        for(i = 0; i < length; ++i) {
-            auto colorIndex = buffer[i];
-            if (colorIndex != tc) {
-                auto& color = state.colorTable[colorIndex];
-                framebuffer.setPixel(state.px, state.py, color.r, color.g, color.b);
-            }
-            // move the pen to the next position
-            ++state.px;
-            if (state.px >= state.right) {
-                ++state.py;
-                state.px = state.left;
-            }
+    void operator()(size_t y, const uint8_t* indices)
+    {
+        const size_t row = y % band.height;
+        if ((row == 0) && gce && gce->transparentColorFlag) {
+            // transparent pixels are left untouched by expandRow
+            std::fill(band.pixels.begin(), band.pixels.end(), 0);
         }
-    }
-    else {
-        // no transparent color
-        for(i = 0; i < length; ++i) {
-            auto colorIndex = buffer[i];
-            auto& color = state.colorTable[colorIndex]; // check length?
-            framebuffer.setPixel(state.px, state.py, color.r, color.g, color.b);
-            // move the pen to the next position
-            ++state.px;
-            if (state.px >= state.right) {
-                ++state.py;
-                state.px = state.left;
-            }
+        detail::expandRow(
+            indices, band.width, palette, gce, band.rowPointer(row));
+        decoded = y + 1;
+        if (row + 1 == band.height) {
+            flush();
         }
+    }
 
+    // delivers the decoded rows that haven't been delivered yet
+    void flush()
+    {
+        if (decoded > delivered) {
+            callback(top + delivered, decoded - delivered, band);
+            delivered = decoded;
+        }
     }
-}
 
-inline void readStartIndex(DecodeState& state, BitStream& input)
-{
-    state.index = input.GetBits(state.dictionary.codeLength);
-    paint(state, state.index);
-    state.old = state.index;
-}
+    const detail::Palette& palette;
+    const GraphicControlExtension* gce;
+    const BandCallback& callback;
+    Frame band;
+    size_t top;
+    size_t decoded;
+    size_t delivered;
+};
 
 } // namespace
 
@@ -376,40 +397,126 @@ std::basic_string_view<uint8_t>::const_iterator ParseImageData(
     const gif::ImageDescriptor& descriptor,
     Frame& frame,
     const gif::ColorTable& table,
-    const GraphicControlExtension* gce)
+    const GraphicControlExtension* gce,
+    const DecodeLimits* limits)
 {
-    // initialize the state
-    DecodeState state(ParseByte(it, end), descriptor, table, gce, frame);
-    BitStream input(it, end);
+    detail::checkBounds(descriptor, frame);
+    detail::checkLimits(descriptor, limits);
+    const uint8_t minCodeSize = ParseByte(it, end);
+    detail::LzwDecoder decoder(
+        minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+    decoder.setInterlaced(descriptor.interlaced);
+    const detail::Palette palette(table);
+    detail::PaintRows sink{descriptor, palette, gce, frame};
+    return decoder.decode(sink);
+}
 
-    auto& dictionary = state.dictionary;
-    if (input.GetBits(dictionary.codeLength) != dictionary.clearCode) {
-        throw std::runtime_error("Expected initial clear code");
+std::basic_string_view<uint8_t>::const_iterator ParseImageRegion(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    const Rect& region,
+    const DecodeLimits* limits)
+{
+    detail::checkBounds(descriptor, frame);
+    detail::checkLimits(descriptor, limits);
+    const size_t left = std::max<size_t>(region.left, descriptor.left);
+    const size_t right = std::min<size_t>(
+        region.left + region.width, size_t(descriptor.left) + descriptor.width);
+    const size_t top = std::max<size_t>(region.top, descriptor.top);
+    const size_t bottom = std::min<size_t>(
+        region.top + region.height, size_t(descriptor.top) + descriptor.height);
+    if ((left >= right) || (top >= bottom)) {
+        // nothing to paint, skip the image data
+        ParseByte(it, end);
+        SkipSubBlocks(it, end);
+        return it;
     }
 
-    readStartIndex(state, input);
-    while(1) {
-        state.index = input.GetBits(dictionary.codeLength);
-        if (state.index < dictionary.currentIndex) { // Does <index> exist in the dictionary?
-            if (state.index == dictionary.eoiCode) {
-                return input.readDataTerminator();
-            }
-            else if (state.index == dictionary.clearCode) {
-                reset(dictionary);
-                readStartIndex(state, input);
+    const uint8_t minCodeSize = ParseByte(it, end);
+    detail::LzwDecoder decoder(
+        minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+    decoder.setInterlaced(descriptor.interlaced);
+    size_t rows = bottom - descriptor.top;
+    if (descriptor.interlaced) {
+        // the last stored row that is inside the region
+        rows = 0;
+        for(size_t y = 0; y < descriptor.height; ++y) {
+            const size_t row = descriptor.top + detail::interlacedRow(y, descriptor.height);
+            if ((row >= top) && (row < bottom)) {
+                rows = y + 1;
             }
-            else { // code that already exists
-                paint(state, state.index);
-                add(dictionary, state.old, getFirstByte(dictionary, state.index));
-            }
-        }
-        else if (state.index == dictionary.currentIndex) {      // <index> does not exist in the dictionary
-            auto b = getFirstByte(dictionary, state.old);       // B <- first byte of string at <old>
-            paint(state, add(dictionary, state.old, b));
         }
-        // <old> <- <index>
-        state.old = state.index;
     }
+    decoder.stopAfter(rows);
+    const detail::Palette palette(table);
+    RegionRows sink{
+        palette,
+        gce,
+        frame,
+        descriptor.left,
+        descriptor.top,
+        left,
+        right,
+        top,
+        bottom};
+    return decoder.decode(sink);
+}
+
+std::basic_string_view<uint8_t>::const_iterator ParseImageIndices(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    std::vector<uint8_t>& indices,
+    const DecodeLimits* limits)
+{
+    detail::checkLimits(descriptor, limits);
+    indices.assign(size_t(descriptor.width) * descriptor.height, 0);
+    const uint8_t minCodeSize = ParseByte(it, end);
+    detail::LzwDecoder decoder(
+        minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+    decoder.setInterlaced(descriptor.interlaced);
+    StoreRows sink{indices, descriptor.width};
+    return decoder.decode(sink);
+}
+
+std::basic_string_view<uint8_t>::const_iterator ParseImageBands(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t bandHeight,
+    const BandCallback& callback,
+    const DecodeLimits* limits)
+{
+    if (descriptor.interlaced) {
+        throw std::runtime_error("Interlaced images can't be decoded in bands.");
+    }
+    if (bandHeight == 0) {
+        throw std::invalid_argument("The band height must be at least one row.");
+    }
+    detail::checkLimits(descriptor, limits);
+
+    const uint8_t minCodeSize = ParseByte(it, end);
+    detail::LzwDecoder decoder(
+        minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+    const detail::Palette palette(table);
+    BandRows sink{
+        palette,
+        gce,
+        callback,
+        Frame(descriptor.width, std::min<size_t>(bandHeight, descriptor.height)),
+        descriptor.top,
+        0,
+        0};
+    auto next = decoder.decode(sink);
+    // deliver the last, possibly partial, band
+    sink.flush();
+    return next;
 }
 
 } // namespace gif
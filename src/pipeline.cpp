@@ -0,0 +1,242 @@
+/**
+ * \file    pipeline.cpp
+ *
+ * \brief   Pipelined image decoding, the LZW decoding runs on the calling
+ *          thread while the decoded rows are expanded on worker threads.
+ */
+
+#include <gif/gif.h>
+#include <gif/bit_stream.h>
+#include "decoder.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace gif {
+
+namespace {
+
+/**
+ * \struct  RowBatch
+ * \brief   A number of rows of color indices, <step> rows apart from each
+ *          other, which is one except in interlaced images.
+ */
+struct RowBatch
+{
+    size_t y;
+    size_t step;
+    size_t rows;
+    std::vector<uint8_t> indices;
+};
+
+/**
+ * \class   BatchQueue
+ * \brief   Hands batches from the decoding thread to the expansion threads.
+ *
+ *  The queue owns a fixed number of batches that circulate between a free
+ *  list and a ready list, which bounds the memory used by the pipeline and
+ *  throttles the decoder if the expansion threads fall behind.
+ */
+class BatchQueue
+{
+public:
+    BatchQueue(size_t batches, size_t batchSize) :
+        storage_(batches),
+        closed_(false)
+    {
+        for(auto& batch : storage_) {
+            batch.indices.resize(batchSize);
+            free_.push_back(&batch);
+        }
+    }
+
+    // returns a batch that the decoder can fill
+    RowBatch* acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        freeCondition_.wait(lock, [this]() { return !free_.empty(); });
+        auto batch = free_.front();
+        free_.pop_front();
+        return batch;
+    }
+
+    // passes a filled batch to the expansion threads
+    void push(RowBatch* batch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.push_back(batch);
+        }
+        readyCondition_.notify_one();
+    }
+
+    // returns a filled batch, or nullptr once the queue has been closed
+    RowBatch* pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        readyCondition_.wait(lock, [this]() { return closed_ || !ready_.empty(); });
+        if (ready_.empty()) {
+            return nullptr;
+        }
+        auto batch = ready_.front();
+        ready_.pop_front();
+        return batch;
+    }
+
+    // returns a expanded batch to the free list
+    void release(RowBatch* batch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(batch);
+        }
+        freeCondition_.notify_one();
+    }
+
+    // wakes up the expansion threads once the remaining batches are done
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        readyCondition_.notify_all();
+    }
+
+private:
+    std::vector<RowBatch> storage_;
+    std::deque<RowBatch*> free_;
+    std::deque<RowBatch*> ready_;
+    std::mutex mutex_;
+    std::condition_variable freeCondition_;
+    std::condition_variable readyCondition_;
+    bool closed_;
+};
+
+/**
+ * \struct  QueueRows
+ * \brief   Row sink that collects decoded rows into batches.
+ */
+struct QueueRows
+{
+    void operator()(size_t y, const uint8_t* indices)
+    {
+        if (batch && !follows(y)) {
+            // the next pass of a interlaced image
+            flush();
+        }
+        if (!batch) {
+            batch = queue.acquire();
+            batch->y = y;
+            batch->step = 1;
+            batch->rows = 0;
+        }
+        else if (batch->rows == 1) {
+            batch->step = y - batch->y;
+        }
+        memcpy(&batch->indices[batch->rows * width], indices, width);
+        if (++batch->rows == rowsPerBatch) {
+            flush();
+        }
+    }
+
+    // the rows of a batch are evenly spaced
+    bool follows(size_t y) const
+    {
+        return (batch->rows == 1) ? (y > batch->y) : (y == batch->y + (batch->rows * batch->step));
+    }
+
+    void flush()
+    {
+        if (batch) {
+            queue.push(batch);
+            batch = nullptr;
+        }
+    }
+
+    BatchQueue& queue;
+    size_t width;
+    size_t rowsPerBatch;
+    RowBatch* batch;
+};
+
+// the number of color indices handed over to a expansion thread at a time
+const size_t kBatchSize = 64 * 1024;
+
+} // namespace
+
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataPipelined(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    Frame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    size_t workers,
+    const DecodeLimits* limits)
+{
+    detail::checkBounds(descriptor, frame);
+    detail::checkLimits(descriptor, limits);
+    const detail::Palette palette(table);
+    workers = std::max<size_t>(workers, 1);
+    const size_t width = descriptor.width;
+    const size_t rowsPerBatch = std::max<size_t>(kBatchSize / std::max<size_t>(width, 1), 1);
+    BatchQueue queue(2 * workers + 2, rowsPerBatch * width);
+
+    std::vector<std::thread> threads;
+    try {
+        for(size_t i = 0; i < workers; ++i) {
+            threads.emplace_back([&]() {
+                while(RowBatch* batch = queue.pop()) {
+                    for(size_t row = 0; row < batch->rows; ++row) {
+                        detail::expandRow(
+                            &batch->indices[row * width],
+                            width,
+                            palette,
+                            gce,
+                            frame.rowPointer(descriptor.top + batch->y + (row * batch->step)) +
+                                (descriptor.left * 4));
+                    }
+                    queue.release(batch);
+                }
+            });
+        }
+    }
+    catch(...) {
+        // a thread couldn't be started, stop the ones that were
+        queue.close();
+        for(auto& thread : threads) {
+            thread.join();
+        }
+        throw;
+    }
+
+    std::basic_string_view<uint8_t>::const_iterator next = end;
+    std::exception_ptr error;
+    try {
+        const uint8_t minCodeSize = ParseByte(it, end);
+        detail::LzwDecoder decoder(
+            minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+        decoder.setInterlaced(descriptor.interlaced);
+        QueueRows sink{queue, width, rowsPerBatch, nullptr};
+        next = decoder.decode(sink);
+        sink.flush();
+    }
+    catch(...) {
+        error = std::current_exception();
+    }
+
+    // let the expansion threads finish the remaining rows
+    queue.close();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return next;
+}
+
+} // namespace gif
@@ -0,0 +1,581 @@
+/**
+ * \file    remux.cpp
+ *
+ * \brief   Extraction and trimming of frames by copying the compressed data.
+ */
+
+#include <gif/remux.h>
+#include "decoder.h"
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace gif {
+
+namespace {
+
+using Iterator = std::basic_string_view<uint8_t>::const_iterator;
+
+/**
+ * \struct  Block
+ * \brief   The bytes of a block in the input file.
+ */
+struct Block
+{
+    Iterator begin;
+    Iterator end;
+};
+
+/**
+ * \struct  RemuxFrame
+ */
+struct RemuxFrame
+{
+    // the extensions preceding the image, except comments and looping
+    std::vector<Block> extensions;
+    ImageDescriptor descriptor;
+    ColorTable localColorTable;
+    GraphicControlExtension gce;
+    bool hasGraphicControl;
+    // the image descriptor, local color table and image data
+    Block image;
+    Iterator data;
+};
+
+/**
+ * \struct  RemuxLayout
+ */
+struct RemuxLayout
+{
+    LogicalScreenDescriptor screen;
+    ColorTable globalColorTable;
+    // the header, logical screen descriptor and global color table
+    Block header;
+    // the looping extension, empty if there is none
+    Block loop;
+    // application extensions preceding the first image
+    std::vector<Block> metadata;
+    std::vector<RemuxFrame> frames;
+};
+
+bool isLoopExtension(const ApplicationExtension& extension)
+{
+    const std::string code(extension.code.begin(), extension.code.end());
+    return ((extension.identifier == "NETSCAPE") && (code == "2.0")) ||
+        ((extension.identifier == "ANIMEXTS") && (code == "1.0"));
+}
+
+RemuxLayout parseLayout(
+    std::basic_string_view<uint8_t> data,
+    const DecodeLimits* limits)
+{
+    RemuxLayout layout;
+    auto it = data.begin();
+    const auto end = data.end();
+    ParseHeader(it, end);
+    layout.screen = ParseLogicalScreenDescriptor(it, end);
+    if (limits && limits->maxCanvasPixels &&
+        (uint64_t(layout.screen.width) * layout.screen.height > limits->maxCanvasPixels))
+    {
+        throw std::runtime_error("Logical screen exceeds the canvas pixel limit.");
+    }
+    if (layout.screen.globalColorTable) {
+        ParseColorTable(
+            layout.globalColorTable,
+            1 << (layout.screen.globalColorTableSize + 1),
+            it,
+            end);
+    }
+    layout.header = Block{data.begin(), it};
+    layout.loop = Block{end, end};
+
+    RemuxFrame frame{};
+    while(1) {
+        const auto begin = it;
+        switch(PeekByte(it, end))
+        {
+        case 0x21:
+            {
+                ++it;   // consume the extension introducer
+                switch(PeekByte(it, end)) {
+                case 0xF9:
+                    frame.gce = ParseGraphicControlExtension(it, end);
+                    frame.hasGraphicControl = true;
+                    frame.extensions.push_back(Block{begin, it});
+                    break;
+                case 0xFF:
+                    if (isLoopExtension(ParseApplicationExtension(it, end))) {
+                        layout.loop = Block{begin, it};
+                    }
+                    else if (layout.frames.empty()) {
+                        layout.metadata.push_back(Block{begin, it});
+                    }
+                    else {
+                        frame.extensions.push_back(Block{begin, it});
+                    }
+                    break;
+                case 0xFE:
+                    // comments are dropped
+                    ++it;
+                    SkipSubBlocks(it, end);
+                    break;
+                default:
+                    // plain text and unknown extensions
+                    ++it;
+                    SkipSubBlocks(it, end);
+                    frame.extensions.push_back(Block{begin, it});
+                    break;
+                }
+                break;
+            }
+        case 0x2c:
+            {
+                if (limits && limits->maxFrames && (layout.frames.size() >= limits->maxFrames)) {
+                    throw std::runtime_error("File exceeds the frame limit.");
+                }
+                frame.descriptor = ParseImageDescriptor(it, end);
+                if (frame.descriptor.localColorTable) {
+                    ParseColorTable(
+                        frame.localColorTable,
+                        1 << (frame.descriptor.localColorTableSize + 1),
+                        it,
+                        end);
+                }
+                frame.data = it;
+                ParseByte(it, end);     // LZW minimum code size
+                SkipSubBlocks(it, end);
+                frame.image = Block{begin, it};
+                layout.frames.push_back(std::move(frame));
+                frame = RemuxFrame{};
+                break;
+            }
+        case 0x3b:
+            return layout;
+        default:
+            throw std::runtime_error("Unexpected block introducer.");
+        }
+    }
+}
+
+// a frame that covers the whole canvas without transparency
+bool isKeyFrame(const RemuxFrame& frame, const LogicalScreenDescriptor& screen)
+{
+    const auto& d = frame.descriptor;
+    return (d.left == 0) && (d.top == 0) &&
+        (d.width >= screen.width) && (d.height >= screen.height) &&
+        !(frame.hasGraphicControl && frame.gce.transparentColorFlag);
+}
+
+int disposalOf(const RemuxFrame& frame)
+{
+    return frame.hasGraphicControl ? frame.gce.disposalMethod : 0;
+}
+
+void append(std::vector<uint8_t>& out, const Block& block)
+{
+    out.insert(out.end(), block.begin, block.end);
+}
+
+void appendShort(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+// draws a frame with a compositor
+void draw(detail::Compositor& compositor, const RemuxLayout& layout, const RemuxFrame& frame)
+{
+    compositor.draw(
+        frame.data,
+        frame.image.end,
+        frame.descriptor,
+        frame.descriptor.localColorTable ? frame.localColorTable : layout.globalColorTable,
+        frame.hasGraphicControl ? &frame.gce : nullptr);
+}
+
+/**
+ * \class   LzwEncoder
+ * \brief   Compresses color indices into LZW image data, with the code width
+ *          rules of LzwDecoder. The dictionary is cleared once it's full.
+ */
+class LzwEncoder
+{
+public:
+    explicit LzwEncoder(uint8_t minCodeSize) :
+        minCodeSize_(minCodeSize),
+        clearCode_(1 << minCodeSize),
+        eoiCode_(clearCode_ + 1),
+        bits_(0),
+        bitCount_(0)
+    {
+        reset();
+    }
+
+    // writes the image data sub-blocks, including the minimum code size
+    void encode(const std::vector<uint8_t>& indices, std::vector<uint8_t>& out)
+    {
+        emit(clearCode_);
+        if (!indices.empty()) {
+            bool afterClear = true;
+            unsigned prefix = indices[0];
+            for(size_t i = 1; i < indices.size(); ++i) {
+                const uint32_t key = (prefix << 8) | indices[i];
+                const int code = find(key);
+                if (code >= 0) {
+                    prefix = code;
+                    continue;
+                }
+                emit(prefix);
+                afterClear = false;
+                if (nextCode_ < 4096) {
+                    insert(key, nextCode_++);
+                }
+                grow();
+                if (nextCode_ >= 4096) {
+                    emit(clearCode_);
+                    reset();
+                    afterClear = true;
+                }
+                prefix = indices[i];
+            }
+            emit(prefix);
+            // the decoder adds a entry for the last code, which may widen
+            // the end of information code
+            if (!afterClear && (nextCode_ < 4096)) {
+                ++nextCode_;
+                grow();
+            }
+        }
+        emit(eoiCode_);
+        if (bitCount_ > 0) {
+            data_.push_back(bits_ & 0xff);
+        }
+
+        out.push_back(minCodeSize_);
+        for(size_t i = 0; i < data_.size(); i += 255) {
+            const size_t size = std::min<size_t>(255, data_.size() - i);
+            out.push_back(static_cast<uint8_t>(size));
+            out.insert(out.end(), data_.begin() + i, data_.begin() + i + size);
+        }
+        out.push_back(0x00);
+    }
+
+private:
+    static const size_t kHashBits = 13;
+
+    void reset()
+    {
+        codeLength_ = minCodeSize_ + 1;
+        nextCode_ = clearCode_ + 2;
+        keys_.assign(size_t(1) << kHashBits, -1);
+        codes_.resize(keys_.size());
+    }
+
+    void grow()
+    {
+        if ((nextCode_ > (1u << codeLength_)) && (codeLength_ < 12)) {
+            ++codeLength_;
+        }
+    }
+
+    void emit(unsigned code)
+    {
+        bits_ |= code << bitCount_;
+        bitCount_ += codeLength_;
+        while(bitCount_ >= 8) {
+            data_.push_back(bits_ & 0xff);
+            bits_ >>= 8;
+            bitCount_ -= 8;
+        }
+    }
+
+    size_t slot(uint32_t key) const
+    {
+        return (key * 2654435761u) >> (32 - kHashBits);
+    }
+
+    int find(uint32_t key) const
+    {
+        const size_t mask = keys_.size() - 1;
+        for(size_t i = slot(key); keys_[i] >= 0; i = (i + 1) & mask) {
+            if (keys_[i] == int32_t(key)) {
+                return codes_[i];
+            }
+        }
+        return -1;
+    }
+
+    void insert(uint32_t key, uint16_t code)
+    {
+        const size_t mask = keys_.size() - 1;
+        size_t i = slot(key);
+        while(keys_[i] >= 0) {
+            i = (i + 1) & mask;
+        }
+        keys_[i] = key;
+        codes_[i] = code;
+    }
+
+    const uint8_t minCodeSize_;
+    const unsigned clearCode_;
+    const unsigned eoiCode_;
+    unsigned codeLength_;
+    unsigned nextCode_;
+    std::vector<int32_t> keys_;
+    std::vector<uint16_t> codes_;
+    std::vector<uint8_t> data_;
+    uint32_t bits_;
+    unsigned bitCount_;
+};
+
+uint32_t rgbOf(const uint8_t* p)
+{
+    return (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | p[2];
+}
+
+/**
+ * \brief   Writes the pixels <begin> to <end> of a canvas, in raster order,
+ *          as a image that covers the rows <top> to <bottom> of the canvas,
+ *          with a local color table. The other pixels of those rows and the
+ *          transparent pixels of the canvas use a transparent color index.
+ */
+void writeImage(
+    std::vector<uint8_t>& out,
+    const Frame& canvas,
+    size_t begin,
+    size_t end,
+    size_t top,
+    size_t bottom,
+    int disposal,
+    const GraphicControlExtension* gce)
+{
+    const size_t first = top * canvas.width;
+    auto isTransparent = [&](size_t pixel) {
+        return (pixel < begin) || (pixel >= end) || (canvas.pixels[pixel * 4 + 3] == 0);
+    };
+
+    ColorTable table;
+    std::unordered_map<uint32_t, uint8_t> lookup;
+    std::vector<uint8_t> indices((bottom - top) * canvas.width);
+    bool transparent = false;
+    for(size_t i = 0; i < indices.size(); ++i) {
+        if (isTransparent(first + i)) {
+            transparent = true;
+            continue;
+        }
+        const uint8_t* p = &canvas.pixels[(first + i) * 4];
+        auto color = lookup.find(rgbOf(p));
+        if (color == lookup.end()) {
+            color = lookup.emplace(rgbOf(p), static_cast<uint8_t>(table.size())).first;
+            table.push_back(Color{p[0], p[1], p[2]});
+        }
+        indices[i] = color->second;
+    }
+
+    // the transparent color index follows the colors of the opaque pixels
+    const uint8_t transparentIndex = static_cast<uint8_t>(table.size());
+    if (transparent) {
+        table.push_back(Color{0, 0, 0});
+        for(size_t i = 0; i < indices.size(); ++i) {
+            if (isTransparent(first + i)) {
+                indices[i] = transparentIndex;
+            }
+        }
+    }
+
+    // the color table has 2^(size + 1) entries
+    unsigned size = 0;
+    while((size_t(2) << size) < table.size()) {
+        ++size;
+    }
+    table.resize(size_t(2) << size, Color{0, 0, 0});
+
+    // graphic control extension
+    out.push_back(0x21);
+    out.push_back(0xF9);
+    out.push_back(0x04);
+    out.push_back(
+        (disposal << 2) |
+        ((gce && gce->userInputFlag) ? 0x02 : 0x00) |
+        (transparent ? 0x01 : 0x00));
+    appendShort(out, gce ? gce->delayTime : 0);
+    out.push_back(transparent ? transparentIndex : 0x00);
+    out.push_back(0x00);
+
+    // image descriptor and local color table
+    out.push_back(0x2c);
+    appendShort(out, 0);
+    appendShort(out, static_cast<uint16_t>(top));
+    appendShort(out, static_cast<uint16_t>(canvas.width));
+    appendShort(out, static_cast<uint16_t>(bottom - top));
+    out.push_back(0x80 | size);
+    for(const auto& color : table) {
+        out.push_back(color.r);
+        out.push_back(color.g);
+        out.push_back(color.b);
+    }
+
+    LzwEncoder encoder(std::max<uint8_t>(size + 1, 2));
+    encoder.encode(indices, out);
+}
+
+/**
+ * \brief   Writes a composited canvas as a image that covers the whole
+ *          canvas. A canvas whose colors don't fit in a single color table
+ *          is split into ranges of pixels with at most 255 colors each, which
+ *          are written as images that are shown without delay and left on
+ *          the canvas, followed by a image covering the whole canvas that has
+ *          the delay and disposal of the frame.
+ */
+void writeCanvas(
+    std::vector<uint8_t>& out,
+    const Frame& canvas,
+    const RemuxFrame& frame,
+    int disposal)
+{
+    const size_t count = canvas.width * canvas.height;
+    const GraphicControlExtension* gce = frame.hasGraphicControl ? &frame.gce : nullptr;
+
+    // the ends of the ranges, a single range if the colors of the opaque
+    // pixels and a transparent color index fit in a color table
+    std::vector<size_t> ends;
+    std::unordered_set<uint32_t> colors;
+    bool transparent = false;
+    for(size_t i = 0; (i < count) && (colors.size() + (transparent ? 1 : 0) <= 256); ++i) {
+        const uint8_t* p = &canvas.pixels[i * 4];
+        if (p[3] == 0) {
+            transparent = true;
+        }
+        else {
+            colors.insert(rgbOf(p));
+        }
+    }
+    if (colors.size() + (transparent ? 1 : 0) > 256) {
+        colors.clear();
+        for(size_t i = 0; i < count; ++i) {
+            const uint8_t* p = &canvas.pixels[i * 4];
+            if ((p[3] != 0) && colors.insert(rgbOf(p)).second && (colors.size() > 255)) {
+                ends.push_back(i);
+                colors.clear();
+                colors.insert(rgbOf(p));
+            }
+        }
+    }
+    ends.push_back(count);
+
+    size_t begin = 0;
+    for(size_t i = 0; i + 1 < ends.size(); ++i) {
+        const size_t end = ends[i];
+        writeImage(out, canvas, begin, end, begin / canvas.width,
+            (end + canvas.width - 1) / canvas.width, 1, nullptr);
+        begin = end;
+    }
+    writeImage(out, canvas, begin, count, 0, canvas.height, disposal, gce);
+}
+
+bool isClear(const Frame& canvas)
+{
+    for(size_t i = 3; i < canvas.pixels.size(); i += 4) {
+        if (canvas.pixels[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void writeLoopExtension(std::vector<uint8_t>& out, uint16_t loopCount)
+{
+    static const char kIdentifier[] = "NETSCAPE2.0";
+    out.push_back(0x21);
+    out.push_back(0xFF);
+    out.push_back(11);
+    out.insert(out.end(), kIdentifier, kIdentifier + 11);
+    out.push_back(0x03);
+    out.push_back(0x01);
+    appendShort(out, loopCount);
+    out.push_back(0x00);
+}
+
+} // namespace
+
+std::vector<uint8_t> RemuxGif(
+    std::basic_string_view<uint8_t> data,
+    const RemuxOptions& options,
+    const DecodeLimits* limits)
+{
+    const RemuxLayout layout = parseLayout(data, limits);
+    const auto& frames = layout.frames;
+    if (options.first >= frames.size()) {
+        throw std::out_of_range("Invalid frame index.");
+    }
+    const size_t last = (options.count > 0) ?
+        std::min(frames.size(), options.first + options.count) : frames.size();
+
+    std::vector<uint8_t> out;
+    bool extended = false;
+    append(out, layout.header);
+    if ((options.loopCount == RemuxOptions::kKeepLoopCount) &&
+        (layout.loop.begin != layout.loop.end))
+    {
+        append(out, layout.loop);
+    }
+    else if (options.loopCount >= 0) {
+        writeLoopExtension(out, static_cast<uint16_t>(options.loopCount));
+        extended = true;
+    }
+    for(const auto& block : layout.metadata) {
+        append(out, block);
+    }
+
+    size_t i = options.first;
+    const auto& first = frames[i];
+    if ((i > 0) && !(isKeyFrame(first, layout.screen) && (disposalOf(first) != 3))) {
+        // the first frame is drawn on top of earlier frames, composite them
+        // starting at the closest key frame that doesn't depend on them either
+        size_t start = i - 1;
+        while((start > 0) &&
+            !(isKeyFrame(frames[start], layout.screen) && (disposalOf(frames[start]) != 3)))
+        {
+            --start;
+        }
+        detail::Compositor compositor(layout.screen.width, layout.screen.height, limits);
+        for(size_t j = start; j < i; ++j) {
+            draw(compositor, layout, frames[j]);
+            compositor.dispose();
+        }
+
+        // re-encode frames until the canvas is the same as in the original
+        // file, either when a frame leaves the canvas as it was displayed, or
+        // when the disposal leaves a clear canvas
+        for(; i < last; ++i) {
+            draw(compositor, layout, frames[i]);
+            const Frame displayed = compositor.canvas();
+            compositor.dispose();
+            const bool unchanged = (compositor.canvas().pixels == displayed.pixels);
+            writeCanvas(out, displayed, frames[i], unchanged ? 1 : 2);
+            extended = true;
+            if (unchanged || isClear(compositor.canvas())) {
+                ++i;
+                break;
+            }
+        }
+    }
+
+    // copy the remaining frames as they are
+    for(; i < last; ++i) {
+        for(const auto& block : frames[i].extensions) {
+            append(out, block);
+        }
+        append(out, frames[i].image);
+    }
+    out.push_back(0x3b);
+
+    if (extended) {
+        // the written extensions require version 89a
+        memcpy(&out[3], "89a", 3);
+    }
+    return out;
+}
+
+} // namespace gif
@@ -0,0 +1,766 @@
+/**
+ * \file    shared_cache.cpp
+ *
+ * \brief   A cache of decoded animations in POSIX shared memory.
+ */
+
+#include <gif/shared_cache.h>
+#include "decoder.h"
+#include "sha256.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace gif {
+
+namespace {
+
+const uint32_t kCacheMagic = 0x43464947;       // "GIFC"
+const uint32_t kSegmentMagic = 0x53464947;     // "GIFS"
+
+// the number of lease records per entry
+const size_t kLeasesPerEntry = 4;
+
+enum SlotState : uint32_t {
+    kEmpty,
+    kPending,       // being decoded by the owner process
+    kReady
+};
+
+/**
+ * \struct  CacheSlot
+ * \brief   A entry of the cache, stored in the control segment.
+ */
+struct CacheSlot
+{
+    detail::Sha256Digest key;
+    uint64_t inputSize;
+    uint64_t id;            // names the data segment
+    uint64_t size;          // the size of the data segment
+    uint64_t lastUse;
+    uint32_t refs;          // the number of leases on the entry
+    uint32_t state;
+    pid_t owner;
+};
+
+/**
+ * \struct  CacheLease
+ * \brief   The references of a single process to a entry. A process that
+ *          dies without releasing its references leaves the lease behind,
+ *          it's reaped once the process is found to be gone.
+ */
+struct CacheLease
+{
+    uint64_t id;            // the entry, zero if the record is unused
+    uint32_t slot;
+    uint32_t refs;
+    pid_t pid;
+};
+
+/**
+ * \struct  CacheHeader
+ * \brief   The start of the control segment, followed by the slots and the
+ *          lease records.
+ */
+struct CacheHeader
+{
+    std::atomic<uint32_t> initialized;
+    uint32_t magic;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    uint64_t budget;
+    uint64_t used;
+    uint64_t clock;
+    uint64_t nextId;
+    uint64_t entries;
+    uint64_t leases;
+};
+
+/**
+ * \struct  SegmentHeader
+ * \brief   The start of a data segment. It's followed by the frame delays,
+ *          padded to 16 bytes, and the RGBA pixels of the frames.
+ */
+struct SegmentHeader
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t width;
+    uint32_t height;
+};
+
+size_t pixelOffset(size_t count)
+{
+    return (sizeof(SegmentHeader) + (count * sizeof(uint16_t)) + 15) & ~size_t(15);
+}
+
+size_t segmentSize(const FileLayout& layout)
+{
+    const size_t count = layout.images.size();
+    return pixelOffset(count) + (count * layout.screen.width * layout.screen.height * 4);
+}
+
+/**
+ * \brief   Composites the frames of a file into a data segment of
+ *          segmentSize(layout) bytes.
+ */
+void writeFrames(
+    const FileLayout& layout,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    uint8_t* segment,
+    const DecodeLimits* limits)
+{
+    const size_t count = layout.images.size();
+    const SegmentHeader header{
+        kSegmentMagic,
+        static_cast<uint32_t>(count),
+        layout.screen.width,
+        layout.screen.height};
+    memcpy(segment, &header, sizeof(header));
+
+    const size_t frameSize = size_t(layout.screen.width) * layout.screen.height * 4;
+    uint8_t* pixels = segment + pixelOffset(count);
+    detail::Compositor compositor(layout.screen.width, layout.screen.height, limits);
+    for(size_t i = 0; i < count; ++i) {
+        const auto& image = layout.images[i];
+        const GraphicControlExtension* gce = image.hasGraphicControl ? &image.gce : nullptr;
+        const uint16_t delay = gce ? gce->delayTime : 0;
+        memcpy(segment + sizeof(header) + (i * sizeof(delay)), &delay, sizeof(delay));
+
+        compositor.draw(
+            image.data,
+            end,
+            image.descriptor,
+            image.descriptor.localColorTable ? image.localColorTable : layout.globalColorTable,
+            gce);
+        memcpy(pixels + (i * frameSize), compositor.canvas().pixels.data(), frameSize);
+        compositor.dispose();
+    }
+}
+
+/**
+ * \class   Lock
+ * \brief   Locks the robust, process shared, mutex of the cache. The state
+ *          is kept consistent by every operation, so a lock left behind by a
+ *          process that died is simply taken over.
+ */
+class Lock
+{
+public:
+    explicit Lock(pthread_mutex_t& mutex) :
+        mutex_(mutex)
+    {
+        check(pthread_mutex_lock(&mutex_));
+    }
+
+    ~Lock()
+    {
+        pthread_mutex_unlock(&mutex_);
+    }
+
+    // waits for a change of the cache, or for <milliseconds> to pass
+    void wait(pthread_cond_t& condition, long milliseconds)
+    {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += milliseconds * 1000000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        const int result = pthread_cond_timedwait(&condition, &mutex_, &deadline);
+        if (result != ETIMEDOUT) {
+            check(result);
+        }
+    }
+
+private:
+    void check(int result)
+    {
+        if (result == EOWNERDEAD) {
+            pthread_mutex_consistent(&mutex_);
+        }
+        else if (result != 0) {
+            throw std::runtime_error("Failed to lock the frame cache.");
+        }
+    }
+
+    pthread_mutex_t& mutex_;
+};
+
+std::string errorMessage(const std::string& message)
+{
+    return message + ": " + strerror(errno);
+}
+
+} // namespace
+
+/*****************************************************************************/
+/*                                SharedFrames                               */
+/*****************************************************************************/
+
+SharedFrames::SharedFrames(
+    const uint8_t* base,
+    size_t size,
+    std::function<void()> release) :
+    base_(base),
+    mappedSize_(size),
+    release_(std::move(release)),
+    current_(SIZE_MAX)
+{
+    SegmentHeader header;
+    memcpy(&header, base_, sizeof(header));
+    if (header.magic != kSegmentMagic) {
+        throw std::runtime_error("Invalid frame cache segment.");
+    }
+    count_ = header.count;
+    width_ = header.width;
+    height_ = header.height;
+    pixels_ = base_ + pixelOffset(count_);
+}
+
+SharedFrames::SharedFrames(std::unique_ptr<FrameStore> store) :
+    base_(nullptr),
+    mappedSize_(0),
+    count_(store->size()),
+    width_(store->screen().width),
+    height_(store->screen().height),
+    pixels_(nullptr),
+    store_(std::move(store)),
+    canvas_(std::make_unique<Frame>(width_, height_)),
+    current_(SIZE_MAX)
+{
+    // empty
+}
+
+SharedFrames::~SharedFrames()
+{
+    if (mappedSize_) {
+        munmap(const_cast<uint8_t*>(base_), mappedSize_);
+    }
+    if (release_) {
+        release_();
+    }
+}
+
+const uint8_t* SharedFrames::pixels(size_t index) const
+{
+    if (index >= count_) {
+        throw std::out_of_range("Invalid frame index.");
+    }
+    if (store_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (current_ != index) {
+            current_ = SIZE_MAX;
+            store_->read(index, *canvas_);
+            current_ = index;
+        }
+        return canvas_->pixels.data();
+    }
+    return pixels_ + (index * width_ * height_ * 4);
+}
+
+uint16_t SharedFrames::delay(size_t index) const
+{
+    if (index >= count_) {
+        throw std::out_of_range("Invalid frame index.");
+    }
+    if (store_) {
+        const GraphicControlExtension* gce = store_->graphicControl(index);
+        return gce ? gce->delayTime : 0;
+    }
+    uint16_t result;
+    memcpy(&result, base_ + sizeof(SegmentHeader) + (index * sizeof(result)), sizeof(result));
+    return result;
+}
+
+/*****************************************************************************/
+/*                              SharedFrameCache                             */
+/*****************************************************************************/
+
+struct SharedFrameCache::Impl
+{
+    explicit Impl(const std::string& cacheName) :
+        name(cacheName),
+        header(nullptr),
+        slots(nullptr),
+        leases(nullptr),
+        mappedSize(0)
+    {
+        // empty
+    }
+
+    ~Impl()
+    {
+        if (header) {
+            munmap(header, mappedSize);
+        }
+    }
+
+    // creates and initializes the control segment
+    void create(int fd, size_t budget, size_t entries)
+    {
+        mappedSize = sizeof(CacheHeader) +
+            (entries * sizeof(CacheSlot)) +
+            (entries * kLeasesPerEntry * sizeof(CacheLease));
+        if (ftruncate(fd, mappedSize) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error(errorMessage("Failed to resize " + name));
+        }
+        map(fd);
+
+        pthread_mutexattr_t mutexAttributes;
+        pthread_mutexattr_init(&mutexAttributes);
+        pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&header->mutex, &mutexAttributes);
+        pthread_mutexattr_destroy(&mutexAttributes);
+
+        pthread_condattr_t conditionAttributes;
+        pthread_condattr_init(&conditionAttributes);
+        pthread_condattr_setpshared(&conditionAttributes, PTHREAD_PROCESS_SHARED);
+        pthread_cond_init(&header->condition, &conditionAttributes);
+        pthread_condattr_destroy(&conditionAttributes);
+
+        header->magic = kCacheMagic;
+        header->budget = budget;
+        header->used = 0;
+        header->clock = 0;
+        header->nextId = 0;
+        header->entries = entries;
+        header->leases = entries * kLeasesPerEntry;
+        // the segment is zero filled, so all slots and leases are unused
+        header->initialized.store(1, std::memory_order_release);
+        slots = reinterpret_cast<CacheSlot*>(header + 1);
+        leases = reinterpret_cast<CacheLease*>(slots + entries);
+    }
+
+    // maps a control segment created by another process
+    void open(int fd)
+    {
+        // wait for the creator to size and initialize the segment
+        for(int attempt = 0; ; ++attempt) {
+            struct stat status;
+            if ((fstat(fd, &status) == 0) && (size_t(status.st_size) >= sizeof(CacheHeader))) {
+                mappedSize = status.st_size;
+                break;
+            }
+            if (attempt == 1000) {
+                close(fd);
+                throw std::runtime_error("Timed out waiting for " + name);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        map(fd);
+        for(int attempt = 0; !header->initialized.load(std::memory_order_acquire); ++attempt) {
+            if (attempt == 1000) {
+                throw std::runtime_error("Timed out waiting for " + name);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if ((header->magic != kCacheMagic) ||
+            (mappedSize < sizeof(CacheHeader) +
+                (header->entries * sizeof(CacheSlot)) +
+                (header->leases * sizeof(CacheLease))))
+        {
+            throw std::runtime_error(name + " isn't a frame cache.");
+        }
+        slots = reinterpret_cast<CacheSlot*>(header + 1);
+        leases = reinterpret_cast<CacheLease*>(slots + header->entries);
+    }
+
+    void map(int fd)
+    {
+        void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error(errorMessage("Failed to map " + name));
+        }
+        header = static_cast<CacheHeader*>(memory);
+    }
+
+    std::string segmentName(uint64_t id) const
+    {
+        return name + "." + std::to_string(id);
+    }
+
+    CacheSlot* find(const detail::Sha256Digest& key, uint64_t inputSize)
+    {
+        for(size_t i = 0; i < header->entries; ++i) {
+            auto& slot = slots[i];
+            if ((slot.state != kEmpty) &&
+                (slot.key == key) &&
+                (slot.inputSize == inputSize))
+            {
+                return &slot;
+            }
+        }
+        return nullptr;
+    }
+
+    // the least recently used entry that isn't referenced
+    CacheSlot* leastRecentlyUsed()
+    {
+        reap();
+        CacheSlot* result = nullptr;
+        for(size_t i = 0; i < header->entries; ++i) {
+            auto& slot = slots[i];
+            if ((slot.state == kReady) && (slot.refs == 0) &&
+                (!result || (slot.lastUse < result->lastUse)))
+            {
+                result = &slot;
+            }
+        }
+        return result;
+    }
+
+    // removes a entry, the segment stays valid for processes that have it
+    // mapped
+    void evict(CacheSlot& slot)
+    {
+        shm_unlink(segmentName(slot.id).c_str());
+        header->used -= slot.size;
+        slot = CacheSlot{};
+    }
+
+    // returns a empty slot, evicting a entry if needed
+    CacheSlot* allocate()
+    {
+        for(size_t i = 0; i < header->entries; ++i) {
+            if (slots[i].state == kEmpty) {
+                return &slots[i];
+            }
+        }
+        CacheSlot* slot = leastRecentlyUsed();
+        if (slot) {
+            evict(*slot);
+        }
+        return slot;
+    }
+
+    // evicts entries until <size> more bytes fit in the budget
+    bool reserve(uint64_t size)
+    {
+        if (size > header->budget) {
+            return false;
+        }
+        while(header->used + size > header->budget) {
+            CacheSlot* slot = leastRecentlyUsed();
+            if (!slot) {
+                return false;
+            }
+            evict(*slot);
+        }
+        return true;
+    }
+
+    // takes a reference to a entry for the calling process, returns false if
+    // all the lease records are in use
+    bool acquire(size_t index)
+    {
+        auto& slot = slots[index];
+        const pid_t pid = getpid();
+        CacheLease* unused = nullptr;
+        for(size_t i = 0; i < header->leases; ++i) {
+            auto& lease = leases[i];
+            if ((lease.id == slot.id) && (lease.slot == index) && (lease.pid == pid)) {
+                ++lease.refs;
+                return true;
+            }
+            if (!unused && (lease.id == 0)) {
+                unused = &lease;
+            }
+        }
+        if (!unused) {
+            reap();
+            for(size_t i = 0; (i < header->leases) && !unused; ++i) {
+                if (leases[i].id == 0) {
+                    unused = &leases[i];
+                }
+            }
+            if (!unused) {
+                return false;
+            }
+        }
+        *unused = CacheLease{slot.id, static_cast<uint32_t>(index), 1, pid};
+        ++slot.refs;
+        return true;
+    }
+
+    // drops the leases of processes that have died
+    void reap()
+    {
+        for(size_t i = 0; i < header->leases; ++i) {
+            auto& lease = leases[i];
+            if ((lease.id != 0) && (kill(lease.pid, 0) != 0) && (errno == ESRCH)) {
+                auto& slot = slots[lease.slot];
+                if ((slot.id == lease.id) && (slot.refs > 0)) {
+                    --slot.refs;
+                }
+                lease = CacheLease{};
+            }
+        }
+    }
+
+    // gives up a pending entry, letting waiting processes decode the file
+    void abandon(size_t index, uint64_t id)
+    {
+        Lock lock(header->mutex);
+        auto& slot = slots[index];
+        if ((slot.id == id) && (slot.state == kPending)) {
+            evict(slot);
+        }
+        pthread_cond_broadcast(&header->condition);
+    }
+
+    void release(size_t index, uint64_t id)
+    {
+        Lock lock(header->mutex);
+        const pid_t pid = getpid();
+        for(size_t i = 0; i < header->leases; ++i) {
+            auto& lease = leases[i];
+            if ((lease.id == id) && (lease.slot == index) && (lease.pid == pid)) {
+                if (--lease.refs == 0) {
+                    lease = CacheLease{};
+                    auto& slot = slots[index];
+                    if ((slot.id == id) && (slot.refs > 0)) {
+                        --slot.refs;
+                    }
+                }
+                return;
+            }
+        }
+    }
+
+    // maps the data segment of a entry that has been referenced
+    std::shared_ptr<const SharedFrames> attach(
+        const std::shared_ptr<Impl>& self,
+        size_t index,
+        uint64_t id)
+    {
+        auto release = [self, index, id]() { self->release(index, id); };
+        const int fd = shm_open(segmentName(id).c_str(), O_RDONLY, 0);
+        struct stat status;
+        if ((fd < 0) || (fstat(fd, &status) != 0)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            release();
+            return nullptr;
+        }
+        void* memory = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            release();
+            return nullptr;
+        }
+        return std::shared_ptr<const SharedFrames>(new SharedFrames(
+            static_cast<const uint8_t*>(memory),
+            status.st_size,
+            release));
+    }
+
+    std::string name;
+    CacheHeader* header;
+    CacheSlot* slots;
+    CacheLease* leases;
+    size_t mappedSize;
+};
+
+SharedFrameCache::SharedFrameCache(
+    const std::string& name,
+    size_t budget,
+    size_t entries) :
+    impl_(std::make_shared<Impl>(name))
+{
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        impl_->create(fd, budget, std::max<size_t>(entries, 1));
+    }
+    else if (errno == EEXIST) {
+        fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            throw std::runtime_error(errorMessage("Failed to open " + name));
+        }
+        impl_->open(fd);
+    }
+    else {
+        throw std::runtime_error(errorMessage("Failed to create " + name));
+    }
+}
+
+SharedFrameCache::~SharedFrameCache()
+{
+    // empty
+}
+
+std::shared_ptr<const SharedFrames> SharedFrameCache::get(
+    std::basic_string_view<uint8_t> data,
+    const DecodeLimits* limits)
+{
+    auto& header = *impl_->header;
+    const auto key = detail::sha256(data.data(), data.size());
+
+    size_t index = SIZE_MAX;
+    uint64_t id = 0;
+    bool cached = false;
+    {
+        Lock lock(header.mutex);
+        while(1) {
+            CacheSlot* slot = impl_->find(key, data.size());
+            if (slot && (slot->state == kReady)) {
+                if (!impl_->acquire(slot - impl_->slots)) {
+                    // too many references, decode into private memory
+                    break;
+                }
+                slot->lastUse = ++header.clock;
+                cached = true;
+            }
+            else if (slot) {
+                // another process is decoding the file, wait for it unless it
+                // has died
+                if ((kill(slot->owner, 0) != 0) && (errno == ESRCH)) {
+                    impl_->evict(*slot);
+                }
+                else {
+                    lock.wait(header.condition, 100);
+                }
+                continue;
+            }
+            else if ((slot = impl_->allocate())) {
+                slot->key = key;
+                slot->inputSize = data.size();
+                slot->id = ++header.nextId;
+                slot->state = kPending;
+                slot->owner = getpid();
+            }
+            if (slot) {
+                index = slot - impl_->slots;
+                id = slot->id;
+            }
+            break;
+        }
+    }
+
+    if (cached) {
+        if (auto frames = impl_->attach(impl_, index, id)) {
+            return frames;
+        }
+        index = SIZE_MAX;
+    }
+
+    auto it = data.begin();
+    const FileLayout layout = ParseFileLayout(it, data.end(), limits);
+    const uint64_t size = segmentSize(layout);
+    if (index != SIZE_MAX) {
+        Lock lock(header.mutex);
+        if (impl_->reserve(size)) {
+            impl_->slots[index].size = size;
+            header.used += size;
+        }
+        else {
+            // the file doesn't fit in the budget
+            impl_->evict(impl_->slots[index]);
+            pthread_cond_broadcast(&header.condition);
+            index = SIZE_MAX;
+        }
+    }
+
+    if (index == SIZE_MAX) {
+        // decode into private memory, keeping the color indices rather than
+        // RGBA frames of the size that didn't fit in the budget
+        auto store = std::make_unique<FrameStore>(layout.screen);
+        for(const auto& image : layout.images) {
+            auto next = image.data;
+            store->add(
+                next,
+                data.end(),
+                image.descriptor,
+                image.descriptor.localColorTable ? image.localColorTable : layout.globalColorTable,
+                image.hasGraphicControl ? &image.gce : nullptr,
+                limits);
+        }
+        return std::shared_ptr<const SharedFrames>(new SharedFrames(std::move(store)));
+    }
+
+    const std::string segment = impl_->segmentName(id);
+    void* memory = MAP_FAILED;
+    try {
+        // a segment left behind by a process that died is replaced
+        shm_unlink(segment.c_str());
+        const int fd = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            throw std::runtime_error(errorMessage("Failed to create " + segment));
+        }
+        if (ftruncate(fd, size) == 0) {
+            memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error(errorMessage("Failed to map " + segment));
+        }
+        writeFrames(layout, data.end(), static_cast<uint8_t*>(memory), limits);
+        mprotect(memory, size, PROT_READ);
+    }
+    catch(...) {
+        if (memory != MAP_FAILED) {
+            munmap(memory, size);
+        }
+        impl_->abandon(index, id);
+        throw;
+    }
+
+    {
+        Lock lock(header.mutex);
+        auto& slot = impl_->slots[index];
+        slot.state = kReady;
+        // without a free lease record the entry can be evicted while it's
+        // mapped, which leaves the mapping valid
+        impl_->acquire(index);
+        slot.lastUse = ++header.clock;
+        pthread_cond_broadcast(&header.condition);
+    }
+    auto self = impl_;
+    return std::shared_ptr<const SharedFrames>(new SharedFrames(
+        static_cast<const uint8_t*>(memory),
+        size,
+        [self, index, id]() { self->release(index, id); }));
+}
+
+size_t SharedFrameCache::memoryUsage() const
+{
+    Lock lock(impl_->header->mutex);
+    return impl_->header->used;
+}
+
+void SharedFrameCache::remove(const std::string& name)
+{
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return;
+    }
+    try {
+        Impl impl(name);
+        impl.open(fd);
+        Lock lock(impl.header->mutex);
+        for(size_t i = 0; i < impl.header->entries; ++i) {
+            if (impl.slots[i].state != kEmpty) {
+                shm_unlink(impl.segmentName(impl.slots[i].id).c_str());
+            }
+        }
+    }
+    catch(std::exception&) {
+        // not a valid cache, only the control segment is removed
+    }
+    shm_unlink(name.c_str());
+}
+
+} // namespace gif
@@ -0,0 +1,108 @@
+/**
+ * \file    thread_pool.cpp
+ */
+
+#include <gif/thread_pool.h>
+
+namespace gif {
+
+namespace {
+
+// identifies the pool and worker that the current thread belongs to
+thread_local const void* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t threads) :
+    nextWorker_(0),
+    pending_(0),
+    stop_(false)
+{
+    if (threads == 0) {
+        threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread([this, i]() { run(i); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for(auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+void ThreadPool::submit(Task task)
+{
+    // tasks created by a worker stay on the queue of that worker
+    const size_t index = (currentPool == this) ?
+        currentWorker : (nextWorker_++ % workers_.size());
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_;
+    }
+    condition_.notify_one();
+}
+
+bool ThreadPool::pop(size_t index, Task& task)
+{
+    {
+        // newest task from the own queue
+        auto& worker = *workers_[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+    // oldest task from any other queue
+    for(size_t i = 1; i < workers_.size(); ++i) {
+        auto& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(size_t index)
+{
+    currentPool = this;
+    currentWorker = index;
+    while(1) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return stop_ || (pending_ > 0); });
+            if (pending_ == 0) {
+                // stopped, and all tasks have been executed
+                return;
+            }
+            // tasks are queued before they are counted, and only taken while
+            // the pool mutex is held, so a single scan finds a counted task
+            pop(index, task);
+            --pending_;
+        }
+        task();
+    }
+}
+
+} // namespace gif
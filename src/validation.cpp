@@ -0,0 +1,78 @@
+/**
+ * \file    validation.cpp
+ */
+
+#include <gif/validation.h>
+#include <gif/bit_stream.h>
+#include "decoder.h"
+#include <string>
+
+namespace gif {
+
+namespace {
+
+const size_t kNoImage = SIZE_MAX;
+
+ValidationResult failure(size_t offset, size_t image, const std::string& message)
+{
+    return ValidationResult{false, offset, image, message};
+}
+
+} // namespace
+
+ValidationResult ValidateGif(
+    std::basic_string_view<uint8_t> data,
+    const DecodeLimits* limits)
+{
+    auto it = data.begin();
+    FileLayout layout;
+    try {
+        layout = ParseFileLayout(it, data.end(), limits);
+    }
+    catch(std::exception& err) {
+        // the iterator has been advanced up to the point of the error
+        return failure(it - data.begin(), kNoImage, err.what());
+    }
+
+    for(size_t i = 0; i < layout.images.size(); ++i) {
+        const auto& image = layout.images[i];
+        const auto& d = image.descriptor;
+        if ((uint32_t(d.left) + d.width > layout.screen.width) ||
+            (uint32_t(d.top) + d.height > layout.screen.height))
+        {
+            // the 10 byte image descriptor precedes the local color table
+            const auto descriptor = image.data - 10 - (3 * image.localColorTable.size());
+            return failure(
+                descriptor - data.begin(),
+                i,
+                "Image doesn't fit in the logical screen.");
+        }
+
+        auto position = image.data;
+        try {
+            const uint8_t minCodeSize = ParseByte(position, data.end());
+            detail::LzwScanner scanner(minCodeSize, BitStream(position, data.end()));
+            try {
+                scanner.scan();
+            }
+            catch(std::exception& err) {
+                return failure(scanner.position() - data.begin(), i, err.what());
+            }
+
+            const uint64_t expected = uint64_t(d.width) * d.height;
+            if (scanner.pixels() != expected) {
+                return failure(
+                    image.data - data.begin(),
+                    i,
+                    "Image data holds " + std::to_string(scanner.pixels()) +
+                    " pixels, expected " + std::to_string(expected) + ".");
+            }
+        }
+        catch(std::exception& err) {
+            return failure(image.data - data.begin(), i, err.what());
+        }
+    }
+    return ValidationResult{true, 0, kNoImage, std::string()};
+}
+
+} // namespace gif
@@ -0,0 +1,243 @@
+/**
+ * \file    yuv.cpp
+ *
+ * \brief   Decoding of images directly into YUV 4:2:0 frames.
+ */
+
+#include <gif/yuv.h>
+#include <gif/bit_stream.h>
+#include "decoder.h"
+#include <cmath>
+#include <cstring>
+
+namespace gif {
+
+namespace {
+
+/**
+ * \struct  YuvPalette
+ * \brief   A color table converted to limited range YUV.
+ */
+struct YuvPalette
+{
+    YuvPalette(const ColorTable& table, ColorMatrix matrix)
+    {
+        // luma coefficients of the color matrix
+        const double kr = (matrix == ColorMatrix::kBt709) ? 0.2126 : 0.299;
+        const double kb = (matrix == ColorMatrix::kBt709) ? 0.0722 : 0.114;
+        const double kg = 1.0 - kr - kb;
+
+        const detail::Palette palette(table);
+        for(size_t i = 0; i < 256; ++i) {
+            const double r = palette[i].r / 255.0;
+            const double g = palette[i].g / 255.0;
+            const double b = palette[i].b / 255.0;
+            const double luma = (kr * r) + (kg * g) + (kb * b);
+            const double cb = (b - luma) / (2.0 * (1.0 - kb));
+            const double cr = (r - luma) / (2.0 * (1.0 - kr));
+            y[i] = static_cast<uint8_t>(std::lround(16.0 + (219.0 * luma)));
+            u[i] = static_cast<uint8_t>(std::lround(128.0 + (224.0 * cb)));
+            v[i] = static_cast<uint8_t>(std::lround(128.0 + (224.0 * cr)));
+        }
+    }
+
+    std::array<uint8_t, 256> y;
+    std::array<uint8_t, 256> u;
+    std::array<uint8_t, 256> v;
+};
+
+/**
+ * \class   YuvRows
+ * \brief   Row sink that writes decoded rows into a YUV frame.
+ *
+ *  Luma is written directly, while the chroma contributions of the pixels
+ *  are summed per 2x2 block and written once the rows of the block are done.
+ */
+class YuvRows
+{
+public:
+    YuvRows(
+        const ImageDescriptor& descriptor,
+        const YuvPalette& palette,
+        const GraphicControlExtension* gce,
+        YuvFrame& frame) :
+        descriptor_(descriptor),
+        palette_(palette),
+        frame_(frame),
+        transparent_((gce && gce->transparentColorFlag) ? gce->transparentColorIndex : -1),
+        firstColumn_(descriptor.left / 2),
+        sumU_(((descriptor.left + descriptor.width + 1) / 2) - firstColumn_),
+        sumV_(sumU_.size()),
+        count_(sumU_.size()),
+        pending_(false),
+        lastRow_(0)
+    {
+        // empty
+    }
+
+    void operator()(size_t y, const uint8_t* indices)
+    {
+        const size_t row = descriptor_.top + y;
+        if (row / 2 != lastRow_ / 2) {
+            // the rows of a interlaced image that ended early can be missing
+            flush(lastRow_ / 2);
+        }
+        const size_t left = descriptor_.left;
+        uint8_t* luma = &frame_.y[(row * frame_.width) + left];
+        if (transparent_ < 0) {
+            for(size_t x = 0; x < descriptor_.width; ++x) {
+                luma[x] = palette_.y[indices[x]];
+            }
+            // pixel pairs that share a chroma column
+            size_t x = 0;
+            if (left & 1) {
+                add(0, indices[0]);
+                ++x;
+            }
+            for(; x + 1 < descriptor_.width; x += 2) {
+                const size_t column = ((left + x) / 2) - firstColumn_;
+                sumU_[column] += palette_.u[indices[x]] + palette_.u[indices[x + 1]];
+                sumV_[column] += palette_.v[indices[x]] + palette_.v[indices[x + 1]];
+                count_[column] += 2;
+            }
+            if (x < descriptor_.width) {
+                add(x, indices[x]);
+            }
+        }
+        else {
+            for(size_t x = 0; x < descriptor_.width; ++x) {
+                if (indices[x] != transparent_) {
+                    luma[x] = palette_.y[indices[x]];
+                    add(x, indices[x]);
+                }
+            }
+        }
+        pending_ = true;
+        lastRow_ = row;
+
+        // the chroma row is done after its odd row, or the last row
+        if ((row & 1) || (y + 1 == descriptor_.height) || (row + 1 == frame_.height)) {
+            flush(row / 2);
+        }
+    }
+
+    // writes the chroma of the last row if the image data ended early
+    void finish()
+    {
+        flush(lastRow_ / 2);
+    }
+
+private:
+    inline void add(size_t x, uint8_t index)
+    {
+        const size_t column = ((descriptor_.left + x) / 2) - firstColumn_;
+        sumU_[column] += palette_.u[index];
+        sumV_[column] += palette_.v[index];
+        ++count_[column];
+    }
+
+    // blends a sum of chroma contributions with the previous chroma value,
+    // pixels of the block that weren't painted keep their share of it
+    static inline uint8_t blend(uint8_t previous, int sum, int count, int pixels)
+    {
+        const int delta = sum - (count * previous);
+        const int change = (delta >= 0) ?
+            ((delta + (pixels / 2)) / pixels) : -((-delta + (pixels / 2)) / pixels);
+        return static_cast<uint8_t>(previous + change);
+    }
+
+    void flush(size_t chromaRow)
+    {
+        if (!pending_) {
+            return;
+        }
+        const int rows = ((2 * chromaRow) + 1 < frame_.height) ? 2 : 1;
+        for(size_t i = 0; i < count_.size(); ++i) {
+            if (count_[i] == 0) {
+                continue;
+            }
+            const size_t column = firstColumn_ + i;
+            const int pixels = rows * (((2 * column) + 1 < frame_.width) ? 2 : 1);
+            uint8_t* u;
+            uint8_t* v;
+            if (frame_.format == YuvFormat::kNV12) {
+                u = &frame_.u[(chromaRow * frame_.chromaWidth * 2) + (column * 2)];
+                v = u + 1;
+            }
+            else {
+                u = &frame_.u[(chromaRow * frame_.chromaWidth) + column];
+                v = &frame_.v[(chromaRow * frame_.chromaWidth) + column];
+            }
+            *u = blend(*u, sumU_[i], count_[i], pixels);
+            *v = blend(*v, sumV_[i], count_[i], pixels);
+            sumU_[i] = 0;
+            sumV_[i] = 0;
+            count_[i] = 0;
+        }
+        pending_ = false;
+    }
+
+    const ImageDescriptor& descriptor_;
+    const YuvPalette& palette_;
+    YuvFrame& frame_;
+    const int transparent_;
+    const size_t firstColumn_;
+    std::vector<int> sumU_;
+    std::vector<int> sumV_;
+    std::vector<int> count_;
+    bool pending_;
+    size_t lastRow_;
+};
+
+} // namespace
+
+std::basic_string_view<uint8_t>::const_iterator ParseImageDataYuv(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end,
+    const gif::ImageDescriptor& descriptor,
+    YuvFrame& frame,
+    const gif::ColorTable& table,
+    const GraphicControlExtension* gce,
+    ColorMatrix matrix,
+    const DecodeLimits* limits)
+{
+    if ((size_t(descriptor.left) + descriptor.width > frame.width) ||
+        (size_t(descriptor.top) + descriptor.height > frame.height))
+    {
+        throw std::runtime_error("The image doesn't fit inside the frame.");
+    }
+    detail::checkLimits(descriptor, limits);
+
+    const YuvPalette palette(table, matrix);
+    const uint8_t minCodeSize = ParseByte(it, end);
+    detail::LzwDecoder decoder(
+        minCodeSize, descriptor.width, descriptor.height, BitStream(it, end), limits);
+    YuvRows sink(descriptor, palette, gce, frame);
+    if (!descriptor.interlaced) {
+        auto next = decoder.decode(sink);
+        sink.finish();
+        return next;
+    }
+
+    // the chroma is summed over pairs of rows, so the rows of a interlaced
+    // image are converted once they have been decoded, in the order they
+    // are shown
+    const size_t width = descriptor.width;
+    std::vector<uint8_t> indices(width * descriptor.height);
+    std::vector<bool> decoded(descriptor.height, false);
+    auto store = [&](size_t y, const uint8_t* row) {
+        memcpy(&indices[y * width], row, width);
+        decoded[y] = true;
+    };
+    decoder.setInterlaced(true);
+    auto next = decoder.decode(store);
+    for(size_t y = 0; y < descriptor.height; ++y) {
+        if (decoded[y]) {
+            sink(y, &indices[y * width]);
+        }
+    }
+    sink.finish();
+    return next;
+}
+
+} // namespace gif
@@ -1,5 +1,7 @@
 #include <gif/gif.h>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <SDL.h>
 #include <boost/optional.hpp>
@@ -54,6 +56,78 @@ std::ostream& operator<<(std::ostream& os, const gif::LogicalScreenDescriptor& l
     return os;
 }
 
+/**
+ * \struct  FrameTimings
+ * \brief   The time spent on the stages of showing a frame, in milliseconds.
+ */
+struct FrameTimings
+{
+    double decode;
+    double upload;
+    double present;
+};
+
+// the number of frames shown in the timing graph
+#define TIMING_HISTORY (200)
+// the scale of the timing graph
+#define PIXELS_PER_MS (8)
+
+double ElapsedMs(Uint64 start, Uint64 stop)
+{
+    return (1000.0 * (stop - start)) / SDL_GetPerformanceFrequency();
+}
+
+// copies a rectangle of the frame buffer into the streaming texture, only the
+// locked rectangle is uploaded
+void UploadRect(SDL_Texture* texture, const gif::Frame& framebuffer, const SDL_Rect& rect)
+{
+    if ((rect.w <= 0) || (rect.h <= 0)) {
+        return;
+    }
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch) != 0) {
+        throw std::runtime_error(SDL_GetError());
+    }
+    for(int y = 0; y < rect.h; ++y) {
+        memcpy(
+            static_cast<uint8_t*>(pixels) + (y * pitch),
+            &framebuffer.pixels[((rect.y + y) * framebuffer.pitch) + (rect.x * 4)],
+            rect.w * 4);
+    }
+    SDL_UnlockTexture(texture);
+}
+
+// draws the timings of the latest frames as stacked bars along the bottom of
+// the window, decode in red, upload in green and present in blue
+void DrawTimings(SDL_Renderer* renderer, const std::deque<FrameTimings>& history)
+{
+    const int barWidth = WINDOW_WIDTH / TIMING_HISTORY;
+    int x = 0;
+    for(const auto& timings : history) {
+        int bottom = WINDOW_HEIGHT;
+        const double stages[] = {timings.decode, timings.upload, timings.present};
+        const Uint8 colors[][3] = {{0xff, 0x40, 0x40}, {0x40, 0xff, 0x40}, {0x40, 0x80, 0xff}};
+        for(size_t i = 0; i < 3; ++i) {
+            SDL_Rect bar;
+            bar.w = barWidth;
+            bar.h = static_cast<int>(stages[i] * PIXELS_PER_MS + 0.5);
+            bar.x = x;
+            bar.y = bottom - bar.h;
+            SDL_SetRenderDrawColor(renderer, colors[i][0], colors[i][1], colors[i][2], 0xff);
+            SDL_RenderFillRect(renderer, &bar);
+            bottom = bar.y;
+        }
+        x += barWidth;
+    }
+
+    // a line at 60 frames per second
+    const int y = WINDOW_HEIGHT - static_cast<int>((1000.0 / 60.0) * PIXELS_PER_MS);
+    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
+    SDL_RenderDrawLine(renderer, 0, y, WINDOW_WIDTH, y);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xff);
+}
+
 int main(int argc, char**argv)
 {
     if (argc < 2) {
@@ -92,23 +166,6 @@ int main(int argc, char**argv)
         return -1;
     }
 
-    Uint32 rmask, gmask, bmask, amask;
-
-    /* SDL interprets each pixel as a 32-bit number, so our masks must depend
-       on the endianness (byte order) of the machine */
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    rmask = 0xff000000;
-    gmask = 0x00ff0000;
-    bmask = 0x0000ff00;
-    amask = 0x000000ff;
-#else
-    rmask = 0x000000ff;
-    gmask = 0x0000ff00;
-    bmask = 0x00ff0000;
-    amask = 0xff000000;
-#endif
-
-
     std::basic_string_view<uint8_t> view(file.data(), file.size());
 
     std::basic_string_view<uint8_t>::const_iterator it = view.begin();
@@ -121,8 +178,21 @@ int main(int argc, char**argv)
 
         gif::Frame framebuffer(lsd.width, lsd.height);
 
-        SDL_Surface* surface = SDL_CreateRGBSurface(0, lsd.width, lsd.height, 32, rmask, gmask, bmask, amask);
-        assert(surface);
+        // a single texture that is updated in place, the frame buffer holds
+        // RGBA bytes
+        SDL_Texture* fbTexture = SDL_CreateTexture(
+            renderer,
+            SDL_PIXELFORMAT_RGBA32,
+            SDL_TEXTUREACCESS_STREAMING,
+            lsd.width,
+            lsd.height);
+        if (!fbTexture) {
+            throw std::runtime_error(SDL_GetError());
+        }
+        SDL_SetTextureBlendMode(fbTexture, SDL_BLENDMODE_BLEND);
+        // the initial contents of a streaming texture are undefined
+        UploadRect(fbTexture, framebuffer, SDL_Rect{0, 0, lsd.width, lsd.height});
+        std::deque<FrameTimings> history;
 
         gif::ColorTable globalColorTable;
         if (lsd.globalColorTable) {
@@ -131,7 +201,6 @@ int main(int argc, char**argv)
 
         SDL_Event e;
         bool quit = false;
-        SDL_Texture* fbTexture = nullptr;
 
         boost::optional<gif::GraphicControlExtension> gce;
         while (!quit) {
@@ -193,6 +262,8 @@ int main(int argc, char**argv)
                         throw std::runtime_error("Interlaced images are currently not supported.");
                     }
 
+                    FrameTimings timings;
+                    const Uint64 decodeStart = SDL_GetPerformanceCounter();
                     it = ParseImageData(
                         it,
                         end,
@@ -201,19 +272,16 @@ int main(int argc, char**argv)
                         descriptor.localColorTable ? localColorTable : globalColorTable,
                         (gce ? gce.get_ptr() : nullptr));
 
-                    // now show the updated frame
-                    SDL_LockSurface(surface);
-                    for(size_t y = 0; y < framebuffer.height; ++y ) {
-                        auto rowp = reinterpret_cast<uint8_t*>(surface->pixels) + (y * (surface->pitch));
-                        memcpy(rowp, framebuffer.rowPointer(y), framebuffer.pitch);
-                    }
-                    SDL_UnlockSurface(surface);
+                    // upload the part of the frame that has changed
+                    const Uint64 uploadStart = SDL_GetPerformanceCounter();
+                    timings.decode = ElapsedMs(decodeStart, uploadStart);
+                    UploadRect(
+                        fbTexture,
+                        framebuffer,
+                        SDL_Rect{descriptor.left, descriptor.top, descriptor.width, descriptor.height});
 
-                    if (fbTexture) {
-                        SDL_DestroyTexture(fbTexture);
-                    }
-                    fbTexture = SDL_CreateTextureFromSurface(renderer, surface);
-                    assert(fbTexture);
+                    const Uint64 presentStart = SDL_GetPerformanceCounter();
+                    timings.upload = ElapsedMs(uploadStart, presentStart);
 
                     SDL_Rect dstRect;
                     dstRect.x = 0;
@@ -222,11 +290,24 @@ int main(int argc, char**argv)
                     dstRect.h = framebuffer.height;
 
                     SDL_RenderClear(renderer);
-                    if (fbTexture) {
-                        SDL_RenderCopy(renderer, fbTexture, nullptr, &dstRect);
-                    }
-
+                    SDL_RenderCopy(renderer, fbTexture, nullptr, &dstRect);
+                    DrawTimings(renderer, history);
                     SDL_RenderPresent(renderer);
+                    timings.present = ElapsedMs(presentStart, SDL_GetPerformanceCounter());
+
+                    history.push_back(timings);
+                    if (history.size() > TIMING_HISTORY) {
+                        history.pop_front();
+                    }
+                    char title[128];
+                    snprintf(
+                        title,
+                        sizeof(title),
+                        "GIF - decode %.2f ms, upload %.2f ms, present %.2f ms",
+                        timings.decode,
+                        timings.upload,
+                        timings.present);
+                    SDL_SetWindowTitle(window, title);
 
                     if (gce) {
                         if (gce->delayTime) {
@@ -0,0 +1,1541 @@
+/**
+ * \file    unit_tests.cpp
+ *
+ * \brief   Behaviour tests of the decoding modes, built on small synthetic
+ *          GIF files.
+ */
+
+#include <gif/gif.h>
+#include <gif/batch.h>
+#include <gif/frame_store.h>
+#include <gif/image_decoder.h>
+#include <gif/remux.h>
+#include <gif/shared_cache.h>
+#include <gif/thread_pool.h>
+#include <gif/validation.h>
+#include <gif/yuv.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: "  \
+                << #condition << std::endl;                                 \
+            ++failures;                                                     \
+        }                                                                   \
+    } while(0)
+
+/*****************************************************************************/
+/*                              Synthetic files                              */
+/*****************************************************************************/
+
+/**
+ * \struct  TestImage
+ */
+struct TestImage
+{
+    uint16_t left;
+    uint16_t top;
+    uint16_t width;
+    uint16_t height;
+    // the encoded color indices, which may be fewer than the image holds
+    std::vector<uint8_t> indices;
+    // the disposal method, or -1 for no graphic control extension
+    int disposal;
+    // the transparent color index, or -1
+    int transparent;
+    uint16_t delay;
+    // the local color table with 2^n entries, or none if empty
+    gif::ColorTable localColorTable = {};
+    // stores the rows in the four passes of the interlaced order
+    bool interlaced = false;
+};
+
+void AppendShort(std::vector<uint8_t>& out, uint16_t value)
+{
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+// encodes color indices as LZW data with a minimum code size of 8, with a
+// clear code whenever the dictionary is full
+void AppendImageData(std::vector<uint8_t>& out, const std::vector<uint8_t>& indices)
+{
+    std::vector<uint8_t> data;
+    uint32_t bits = 0;
+    unsigned count = 0;
+    // the code width follows the dictionary of the decoder, which lags one
+    // code behind the dictionary of the encoder
+    unsigned codeLength = 9;
+    unsigned decoderIndex = 258;
+    size_t codes = 0;
+    auto emit = [&](unsigned code) {
+        bits |= code << count;
+        count += codeLength;
+        while(count >= 8) {
+            data.push_back(bits & 0xff);
+            bits >>= 8;
+            count -= 8;
+        }
+        if (code == 256) {
+            codeLength = 9;
+            decoderIndex = 258;
+            codes = 0;
+            return;
+        }
+        if ((codes++ > 0) && (decoderIndex < 4096)) {
+            if ((decoderIndex == (1u << codeLength) - 1) && (codeLength < 12)) {
+                ++codeLength;
+            }
+            ++decoderIndex;
+        }
+    };
+
+    std::map<uint32_t, unsigned> dictionary;
+    unsigned nextIndex = 258;
+    int prefix = -1;
+    emit(256);
+    for(const uint8_t index : indices) {
+        if (prefix < 0) {
+            prefix = index;
+            continue;
+        }
+        const uint32_t key = (uint32_t(prefix) << 8) | index;
+        const auto entry = dictionary.find(key);
+        if (entry != dictionary.end()) {
+            prefix = entry->second;
+            continue;
+        }
+        emit(prefix);
+        dictionary[key] = nextIndex++;
+        if (nextIndex == 4095) {
+            emit(256);
+            dictionary.clear();
+            nextIndex = 258;
+        }
+        prefix = index;
+    }
+    if (prefix >= 0) {
+        emit(prefix);
+    }
+    emit(257);
+    if (count > 0) {
+        data.push_back(bits & 0xff);
+    }
+
+    out.push_back(8);
+    for(size_t i = 0; i < data.size(); i += 255) {
+        const size_t size = std::min<size_t>(255, data.size() - i);
+        out.push_back(static_cast<uint8_t>(size));
+        out.insert(out.end(), data.begin() + i, data.begin() + i + size);
+    }
+    out.push_back(0);
+}
+
+// a 256 entry color table where every entry has a distinct color
+gif::ColorTable TestColorTable()
+{
+    gif::ColorTable table(256);
+    for(size_t i = 0; i < table.size(); ++i) {
+        table[i] = gif::Color{
+            static_cast<uint8_t>(i),
+            static_cast<uint8_t>(255 - i),
+            static_cast<uint8_t>((i * 7) & 0xff)};
+    }
+    return table;
+}
+
+std::vector<uint8_t> MakeGif(
+    uint16_t width,
+    uint16_t height,
+    const std::vector<TestImage>& images)
+{
+    std::vector<uint8_t> out{'G', 'I', 'F', '8', '9', 'a'};
+    AppendShort(out, width);
+    AppendShort(out, height);
+    out.push_back(0xf7);    // global color table with 256 entries
+    out.push_back(0);
+    out.push_back(0);
+    for(const auto& color : TestColorTable()) {
+        out.push_back(color.r);
+        out.push_back(color.g);
+        out.push_back(color.b);
+    }
+    for(const auto& image : images) {
+        if (image.disposal >= 0) {
+            out.insert(out.end(), {0x21, 0xf9, 0x04});
+            out.push_back((image.disposal << 2) | ((image.transparent >= 0) ? 1 : 0));
+            AppendShort(out, image.delay);
+            out.push_back((image.transparent >= 0) ? image.transparent : 0);
+            out.push_back(0);
+        }
+        out.push_back(0x2c);
+        AppendShort(out, image.left);
+        AppendShort(out, image.top);
+        AppendShort(out, image.width);
+        AppendShort(out, image.height);
+        const uint8_t interlaced = image.interlaced ? 0x40 : 0x00;
+        if (image.localColorTable.empty()) {
+            out.push_back(interlaced);
+        }
+        else {
+            unsigned size = 0;
+            while((size_t(2) << size) < image.localColorTable.size()) {
+                ++size;
+            }
+            out.push_back(0x80 | interlaced | size);
+            for(const auto& color : image.localColorTable) {
+                out.push_back(color.r);
+                out.push_back(color.g);
+                out.push_back(color.b);
+            }
+        }
+        if (!image.interlaced) {
+            AppendImageData(out, image.indices);
+            continue;
+        }
+        std::vector<uint8_t> rows;
+        for(const auto& pass : {std::make_pair(0, 8), {4, 8}, {2, 4}, {1, 2}}) {
+            for(size_t y = pass.first; y < image.height; y += pass.second) {
+                const size_t begin = std::min(y * image.width, image.indices.size());
+                const size_t end = std::min(begin + image.width, image.indices.size());
+                rows.insert(rows.end(), image.indices.begin() + begin, image.indices.begin() + end);
+            }
+        }
+        AppendImageData(out, rows);
+    }
+    out.push_back(0x3b);
+    return out;
+}
+
+std::basic_string_view<uint8_t> View(const std::vector<uint8_t>& file)
+{
+    return std::basic_string_view<uint8_t>(file.data(), file.size());
+}
+
+/**
+ * \struct  TestImageBlock
+ * \brief   A image of a file, located without the parsers under test.
+ */
+struct TestImageBlock
+{
+    gif::ImageDescriptor descriptor;
+    gif::ColorTable localColorTable;
+    gif::GraphicControlExtension gce;
+    bool hasGraphicControl;
+    // the LZW minimum code size byte that starts the image data
+    std::basic_string_view<uint8_t>::const_iterator data;
+    // the data following the image data terminator
+    std::basic_string_view<uint8_t>::const_iterator next;
+};
+
+/**
+ * \struct  TestFile
+ * \brief   The blocks of a file, which must outlive it.
+ */
+struct TestFile
+{
+    std::basic_string_view<uint8_t> view;
+    gif::LogicalScreenDescriptor screen;
+    gif::ColorTable globalColorTable;
+    std::vector<TestImageBlock> images;
+
+    const gif::ColorTable& table(const TestImageBlock& image) const
+    {
+        return image.descriptor.localColorTable ? image.localColorTable : globalColorTable;
+    }
+};
+
+void SkipTestSubBlocks(
+    std::basic_string_view<uint8_t>::const_iterator& it,
+    std::basic_string_view<uint8_t>::const_iterator end)
+{
+    while(const uint8_t size = gif::ParseByte(it, end)) {
+        if (static_cast<size_t>(end - it) < size) {
+            throw std::runtime_error("Truncated sub-block.");
+        }
+        it += size;
+    }
+}
+
+TestFile ParseTestFile(const std::vector<uint8_t>& file)
+{
+    TestFile result;
+    result.view = View(file);
+    auto it = result.view.begin();
+    const auto end = result.view.end();
+    gif::ParseHeader(it, end);
+    result.screen = gif::ParseLogicalScreenDescriptor(it, end);
+    if (result.screen.globalColorTable) {
+        gif::ParseColorTable(
+            result.globalColorTable,
+            1 << (result.screen.globalColorTableSize + 1),
+            it,
+            end);
+    }
+
+    gif::GraphicControlExtension gce{};
+    bool hasGraphicControl = false;
+    while(1) {
+        const uint8_t introducer = gif::ParseByte(it, end);
+        if (introducer == 0x3b) {
+            break;
+        }
+        if (introducer == 0x21) {
+            if (gif::PeekByte(it, end) == 0xf9) {
+                gce = gif::ParseGraphicControlExtension(it, end);
+                hasGraphicControl = true;
+            }
+            else {
+                ++it;   // the extension label
+                SkipTestSubBlocks(it, end);
+            }
+            continue;
+        }
+        if (introducer != 0x2c) {
+            throw std::runtime_error("Unexpected block.");
+        }
+        --it;
+        TestImageBlock image;
+        image.descriptor = gif::ParseImageDescriptor(it, end);
+        if (image.descriptor.localColorTable) {
+            gif::ParseColorTable(
+                image.localColorTable,
+                1 << (image.descriptor.localColorTableSize + 1),
+                it,
+                end);
+        }
+        image.gce = gce;
+        image.hasGraphicControl = hasGraphicControl;
+        hasGraphicControl = false;
+        image.data = it;
+        gif::ParseByte(it, end);
+        SkipTestSubBlocks(it, end);
+        image.next = it;
+        result.images.push_back(image);
+    }
+    return result;
+}
+
+// a animation of small images at random positions, with random disposal
+// methods and transparency, and a occasional image that covers the canvas
+std::vector<TestImage> RandomImages(
+    std::mt19937& random,
+    uint16_t width,
+    uint16_t height,
+    size_t count)
+{
+    std::vector<TestImage> images;
+    for(size_t i = 0; i < count; ++i) {
+        TestImage image;
+        if ((random() % 8) == 0) {
+            image.left = 0;
+            image.top = 0;
+            image.width = width;
+            image.height = height;
+        }
+        else {
+            image.width = 1 + (random() % width);
+            image.height = 1 + (random() % height);
+            image.left = random() % (width - image.width + 1);
+            image.top = random() % (height - image.height + 1);
+        }
+        // runs of colors, so that the LZW data uses longer strings
+        image.indices.resize(size_t(image.width) * image.height);
+        uint8_t color = 0;
+        for(auto& index : image.indices) {
+            if ((random() % 4) == 0) {
+                color = random() % 16;
+            }
+            index = color;
+        }
+        image.disposal = random() % 4;
+        image.transparent = ((random() % 3) == 0) ? 3 : -1;
+        image.delay = random() % 100;
+        images.push_back(image);
+    }
+    return images;
+}
+
+// a animation of a 6x4 canvas that uses every disposal method, <shift>
+// varies the colors
+std::vector<TestImage> DisposalImages(uint8_t shift)
+{
+    std::vector<TestImage> images{
+        TestImage{0, 0, 6, 4, {}, 1, -1, 10},
+        TestImage{1, 1, 3, 2, {}, 2, -1, 10},
+        TestImage{2, 0, 4, 3, {}, 3, 3, 10},
+        TestImage{0, 2, 2, 2, {}, -1, -1, 0},
+        TestImage{1, 0, 2, 4, {}, 0, 3, 10},
+        TestImage{0, 0, 6, 4, {}, 2, -1, 10},
+        TestImage{3, 1, 2, 2, {}, 3, -1, 10},
+        TestImage{0, 0, 6, 1, {}, 1, 3, 10}};
+    for(size_t i = 0; i < images.size(); ++i) {
+        auto& image = images[i];
+        for(size_t y = 0; y < image.height; ++y) {
+            for(size_t x = 0; x < image.width; ++x) {
+                image.indices.push_back(static_cast<uint8_t>(((x * 3) + (y * 5) + i + shift) % 16));
+            }
+        }
+    }
+    return images;
+}
+
+/**
+ * \brief   Composites every frame of a file with ParseImageData, applying the
+ *          disposal methods as the GIF specification describes.
+ */
+std::vector<gif::Frame> ReferenceFrames(const std::vector<uint8_t>& data)
+{
+    const auto file = ParseTestFile(data);
+    std::vector<gif::Frame> frames;
+    gif::Frame canvas(file.screen.width, file.screen.height);
+    for(const auto& image : file.images) {
+        const gif::Frame previous = canvas;
+        auto it = image.data;
+        gif::ParseImageData(
+            it,
+            file.view.end(),
+            image.descriptor,
+            canvas,
+            file.table(image),
+            image.hasGraphicControl ? &image.gce : nullptr);
+        frames.push_back(canvas);
+
+        const auto& d = image.descriptor;
+        const int disposal = image.hasGraphicControl ? image.gce.disposalMethod : 0;
+        if (disposal == 2) {
+            for(size_t y = d.top; y < size_t(d.top) + d.height; ++y) {
+                memset(canvas.rowPointer(y) + (d.left * 4), 0, size_t(d.width) * 4);
+            }
+        }
+        else if (disposal == 3) {
+            canvas = previous;
+        }
+    }
+    return frames;
+}
+
+gif::FrameStore LoadFrameStore(
+    const std::vector<uint8_t>& data,
+    bool compress,
+    size_t checkpointInterval = 32)
+{
+    const auto file = ParseTestFile(data);
+    gif::FrameStore store(file.screen, compress, checkpointInterval);
+    for(const auto& image : file.images) {
+        auto it = image.data;
+        store.add(
+            it,
+            file.view.end(),
+            image.descriptor,
+            file.table(image),
+            image.hasGraphicControl ? &image.gce : nullptr);
+    }
+    return store;
+}
+
+/*****************************************************************************/
+/*                                 FrameStore                                */
+/*****************************************************************************/
+
+// every frame can be read in any order, with and without compression
+void TestFrameStoreDisposal()
+{
+    const auto data = MakeGif(6, 4, DisposalImages(0));
+    const auto reference = ReferenceFrames(data);
+    for(bool compress : {false, true}) {
+        const auto store = LoadFrameStore(data, compress);
+        CHECK(store.size() == reference.size());
+        gif::Frame canvas(6, 4);
+        for(size_t i = reference.size(); i > 0; --i) {
+            store.read(i - 1, canvas);
+            CHECK(canvas.pixels == reference[i - 1].pixels);
+        }
+        for(size_t i = 0; i < reference.size(); ++i) {
+            store.read(i, canvas);
+            CHECK(canvas.pixels == reference[i].pixels);
+        }
+    }
+}
+
+// disposing a image that covers the canvas with "restore to previous" brings
+// back the earlier frames
+void TestFrameStoreRestorePreviousKeyFrame()
+{
+    const auto data = MakeGif(2, 1, {
+        TestImage{0, 0, 2, 1, {1, 1}, 1, -1, 0},
+        TestImage{0, 0, 2, 1, {2, 2}, 3, -1, 0},
+        TestImage{0, 0, 1, 1, {4}, -1, -1, 0}});
+    const auto store = LoadFrameStore(data, true);
+    gif::Frame canvas(2, 1);
+    store.read(2, canvas);
+    const auto table = TestColorTable();
+    CHECK(canvas.pixels[0] == table[4].r);
+    CHECK(canvas.pixels[4] == table[1].r);
+    CHECK(canvas.pixels[5] == table[1].g);
+    CHECK(canvas.pixels[6] == table[1].b);
+    CHECK(canvas.pixels[7] == 0xff);
+}
+
+// random access reads match the frames composited in order, with and without
+// checkpoints
+void TestFrameStoreRoundTrip()
+{
+    std::mt19937 random(26);
+    for(size_t round = 0; round < 20; ++round) {
+        const auto data = MakeGif(24, 16, RandomImages(random, 24, 16, 150));
+        const auto reference = ReferenceFrames(data);
+        for(size_t interval : {size_t(0), size_t(1), size_t(7), size_t(32)}) {
+            const auto store = LoadFrameStore(data, true, interval);
+            CHECK(store.size() == reference.size());
+            gif::Frame canvas(24, 16);
+            for(size_t i = 0; i < reference.size(); ++i) {
+                const size_t index = random() % reference.size();
+                store.read(index, canvas);
+                CHECK(canvas.pixels == reference[index].pixels);
+            }
+        }
+    }
+}
+
+// repeated images are stored once, also when they are shown with a different
+// delay or disposal method, but not when they are drawn differently
+void TestFrameStoreDuplicates()
+{
+    std::vector<uint8_t> indices(48);
+    for(size_t i = 0; i < indices.size(); ++i) {
+        indices[i] = static_cast<uint8_t>(i % 5);
+    }
+    const std::vector<TestImage> images{
+        TestImage{2, 1, 8, 6, indices, 1, -1, 10},
+        TestImage{0, 0, 4, 4, std::vector<uint8_t>(16, 3), 1, -1, 10},
+        TestImage{2, 1, 8, 6, indices, 1, -1, 50},      // other delay
+        TestImage{2, 1, 8, 6, indices, 2, -1, 10},      // other disposal
+        TestImage{2, 1, 8, 6, indices, -1, -1, 0},      // no graphic control
+        TestImage{2, 1, 8, 6, indices, 1, 3, 10},       // transparent
+        TestImage{2, 1, 8, 6, indices, 3, 3, 20},       // transparent, other timing
+        TestImage{3, 1, 8, 6, indices, 1, -1, 10},      // moved
+        TestImage{2, 1, 6, 8, indices, 1, -1, 10},      // other shape
+    };
+    const std::vector<size_t> expected{0, 1, 0, 0, 0, 5, 5, 7, 8};
+    const auto data = MakeGif(12, 10, images);
+    const auto reference = ReferenceFrames(data);
+
+    auto it = View(data).begin();
+    const auto layout = gif::ParseFileLayout(it, View(data).end());
+    CHECK(gif::FindDuplicateImages(layout) == expected);
+
+    for(bool compress : {false, true}) {
+        // decoded by the store, and added from indices decoded beforehand
+        const auto decoded = LoadFrameStore(data, compress);
+        gif::FrameStore added(layout.screen, compress);
+        for(size_t i = 0; i < layout.images.size(); ++i) {
+            const auto& image = layout.images[i];
+            const gif::GraphicControlExtension* gce = image.hasGraphicControl ? &image.gce : nullptr;
+            if (expected[i] != i) {
+                added.addDuplicate(expected[i], gce);
+                continue;
+            }
+            std::vector<uint8_t> imageIndices;
+            auto next = image.data;
+            gif::ParseImageIndices(next, View(data).end(), image.descriptor, imageIndices);
+            added.add(image.descriptor, layout.globalColorTable, gce, imageIndices);
+        }
+
+        const gif::FrameStore* stores[] = {&decoded, &added};
+        for(const auto* store : stores) {
+            CHECK(store->size() == reference.size());
+            gif::Frame canvas(12, 10);
+            for(size_t i = 0; i < std::min(store->size(), reference.size()); ++i) {
+                CHECK(store->duplicateOf(i) == expected[i]);
+                store->read(i, canvas);
+                CHECK(canvas.pixels == reference[i].pixels);
+                const auto* gce = store->graphicControl(i);
+                CHECK((gce != nullptr) == (images[i].disposal >= 0));
+                CHECK(!gce || ((gce->delayTime == images[i].delay) && (gce->disposalMethod == images[i].disposal)));
+            }
+        }
+        CHECK(decoded.memoryUsage() == added.memoryUsage());
+    }
+}
+
+/*****************************************************************************/
+/*                                  Decoders                                 */
+/*****************************************************************************/
+
+// image data that ends before the last pixel paints the decoded pixels, also
+// of an incomplete last row, and leaves the remaining pixels untouched
+void TestParallelPartialData()
+{
+    for(size_t count = 0; count <= 4; ++count) {
+        std::vector<uint8_t> indices;
+        for(size_t i = 0; i < count; ++i) {
+            indices.push_back(static_cast<uint8_t>(i + 1));
+        }
+        const auto data = MakeGif(2, 2, {TestImage{0, 0, 2, 2, indices, -1, -1, 0}});
+        const auto file = ParseTestFile(data);
+        const auto& image = file.images[0];
+
+        gif::Frame frame(2, 2);
+        std::fill(frame.pixels.begin(), frame.pixels.end(), 7);
+        auto it = image.data;
+        gif::ParseImageDataParallel(it, file.view.end(), image.descriptor, frame, file.globalColorTable, nullptr, 4);
+
+        const auto table = TestColorTable();
+        for(size_t i = 0; i < 4; ++i) {
+            const uint8_t* pixel = &frame.pixels[i * 4];
+            if (i < count) {
+                CHECK(pixel[0] == table[i + 1].r);
+                CHECK(pixel[1] == table[i + 1].g);
+                CHECK(pixel[2] == table[i + 1].b);
+                CHECK(pixel[3] == 0xff);
+            }
+            else {
+                CHECK((pixel[0] == 7) && (pixel[1] == 7) && (pixel[2] == 7) && (pixel[3] == 7));
+            }
+        }
+    }
+}
+
+// the time limit of a resumable decoder doesn't count the time between the
+// calls to decode()
+void TestImageDecoderTimeLimit()
+{
+    // noise, so that the image data holds about one code per pixel
+    std::mt19937 random(31);
+    std::vector<uint8_t> indices(10000);
+    for(auto& index : indices) {
+        index = random() & 0xff;
+    }
+    const auto data = MakeGif(100, 100, {TestImage{0, 0, 100, 100, indices, -1, -1, 0}});
+    const auto file = ParseTestFile(data);
+    const auto& image = file.images[0];
+
+    gif::DecodeLimits limits;
+    limits.maxTime = std::chrono::milliseconds(50);
+    gif::Frame frame(100, 100);
+    gif::ImageDecoder decoder(image.data, file.view.end(), image.descriptor, frame, file.globalColorTable, nullptr, &limits);
+    gif::DecodeBudget budget;
+    budget.codes = 1000;
+    bool complete = false;
+    for(size_t i = 0; (i < 20) && !complete; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        complete = (decoder.decode(budget) == gif::DecodeStatus::kComplete);
+    }
+    CHECK(complete);
+    CHECK(decoder.decodedPixels() == 10000);
+}
+
+// image data that is cut off anywhere, or that starts with the terminator
+// block, is rejected by every decoder without reading past its end
+void TestTruncatedImageData()
+{
+    std::mt19937 random(31);
+    std::vector<uint8_t> indices(600);
+    for(auto& index : indices) {
+        index = random() & 0xff;
+    }
+    const auto data = MakeGif(30, 20, {TestImage{0, 0, 30, 20, indices, -1, -1, 0}});
+    const auto file = ParseTestFile(data);
+    const auto& image = file.images[0];
+    const auto& d = image.descriptor;
+    const auto& table = file.globalColorTable;
+
+    using Iterator = std::basic_string_view<uint8_t>::const_iterator;
+    auto rejected = [&](const std::vector<uint8_t>& input) {
+        const auto view = View(input);
+        const std::function<void(Iterator&, gif::Frame&)> decoders[] = {
+            [&](auto& it, auto& frame) { gif::ParseImageData(it, view.end(), d, frame, table, nullptr); },
+            [&](auto& it, auto& frame) { gif::ParseImageDataPipelined(it, view.end(), d, frame, table, nullptr, 2); },
+            [&](auto& it, auto& frame) { gif::ParseImageDataParallel(it, view.end(), d, frame, table, nullptr, 2); },
+            [&](auto& it, auto&) {
+                std::vector<uint8_t> result;
+                gif::ParseImageIndices(it, view.end(), d, result);
+            },
+            [&](auto& it, auto& frame) {
+                gif::ImageDecoder decoder(it, view.end(), d, frame, table, nullptr);
+                gif::DecodeBudget budget;
+                budget.codes = 50;
+                while(decoder.decode(budget) != gif::DecodeStatus::kComplete) {
+                }
+            }};
+        size_t count = 0;
+        for(const auto& decode : decoders) {
+            gif::Frame frame(30, 20);
+            auto it = view.begin();
+            try {
+                decode(it, frame);
+            }
+            catch(std::exception&) {
+                ++count;
+            }
+        }
+        return count == std::size(decoders);
+    };
+
+    // every decoder gets a buffer of the exact size, so that reads past its
+    // end are caught by the address sanitizer
+    for(auto cut = image.data + 1; cut < image.next; ++cut) {
+        CHECK(rejected(std::vector<uint8_t>(image.data, cut)));
+    }
+    CHECK(rejected({8, 0}));
+    CHECK(rejected({8, 0, 0x3b}));
+
+    std::vector<uint8_t> empty(file.view.begin(), image.data);
+    empty.insert(empty.end(), {8, 0, 0x3b});
+    CHECK(!gif::ValidateGif(View(empty)).valid);
+}
+
+// every decoder of a single image checks the image rectangle against the
+// pixel limits and the LZW output against the output limit, the file
+// parser also checks the screen, the number of images and their total size
+void TestDecodeLimits()
+{
+    // 300 indices for 200 pixels, the excess data counts as output
+    std::mt19937 random(31);
+    std::vector<uint8_t> indices(300);
+    for(auto& index : indices) {
+        index = random() & 0xff;
+    }
+    const auto data = MakeGif(20, 10, {
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0},
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0},
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0}});
+    const auto file = ParseTestFile(data);
+    const auto& image = file.images[0];
+    const auto& d = image.descriptor;
+    const auto& table = file.globalColorTable;
+    const auto end = file.view.end();
+
+    using Iterator = std::basic_string_view<uint8_t>::const_iterator;
+    const std::pair<const char*, std::function<void(Iterator&, const gif::DecodeLimits&)>> decoders[] = {
+        {"data", [&](auto& it, const auto& limits) {
+            gif::Frame frame(20, 10);
+            gif::ParseImageData(it, end, d, frame, table, nullptr, &limits);
+        }},
+        {"region", [&](auto& it, const auto& limits) {
+            gif::Frame frame(20, 10);
+            gif::ParseImageRegion(it, end, d, frame, table, nullptr, gif::Rect{0, 0, 20, 10}, &limits);
+        }},
+        {"indices", [&](auto& it, const auto& limits) {
+            std::vector<uint8_t> result;
+            gif::ParseImageIndices(it, end, d, result, &limits);
+        }},
+        {"bands", [&](auto& it, const auto& limits) {
+            gif::ParseImageBands(it, end, d, table, nullptr, 3, [](size_t, size_t, const gif::Frame&) {}, &limits);
+        }},
+        {"pipelined", [&](auto& it, const auto& limits) {
+            gif::Frame frame(20, 10);
+            gif::ParseImageDataPipelined(it, end, d, frame, table, nullptr, 2, &limits);
+        }},
+        {"parallel", [&](auto& it, const auto& limits) {
+            gif::Frame frame(20, 10);
+            gif::ParseImageDataParallel(it, end, d, frame, table, nullptr, 2, &limits);
+        }},
+        {"yuv", [&](auto& it, const auto& limits) {
+            gif::YuvFrame frame(20, 10, gif::YuvFormat::kI420);
+            gif::ParseImageDataYuv(it, end, d, frame, table, nullptr, gif::ColorMatrix::kBt709, &limits);
+        }},
+        {"resumable", [&](auto& it, const auto& limits) {
+            gif::Frame frame(20, 10);
+            gif::ImageDecoder decoder(it, end, d, frame, table, nullptr, &limits);
+            while(decoder.decode(gif::DecodeBudget()) != gif::DecodeStatus::kComplete) {
+            }
+        }}};
+    // returns whether the decoder rejected the image
+    auto rejected = [&](const auto& decoder, const gif::DecodeLimits& limits) {
+        auto it = image.data;
+        try {
+            decoder.second(it, limits);
+        }
+        catch(std::exception&) {
+            return true;
+        }
+        return false;
+    };
+
+    for(const auto& decoder : decoders) {
+        gif::DecodeLimits limits;
+        limits.maxCanvasPixels = 199;
+        CHECK(rejected(decoder, limits));
+        limits.maxCanvasPixels = 200;
+        CHECK(!rejected(decoder, limits));
+
+        limits = gif::DecodeLimits();
+        limits.maxTotalPixels = 199;
+        CHECK(rejected(decoder, limits));
+        limits.maxTotalPixels = 200;
+        CHECK(!rejected(decoder, limits));
+
+        limits = gif::DecodeLimits();
+        limits.maxFrameOutput = 199;
+        CHECK(rejected(decoder, limits));
+        limits.maxFrameOutput = 300;
+        const bool failed = rejected(decoder, limits);
+        CHECK(!failed);
+        if (failed) {
+            std::cerr << "  " << decoder.first << " rejected the output limit" << std::endl;
+        }
+    }
+
+    // the images of a valid file hold exactly their pixels
+    indices.resize(200);
+    const auto exact = MakeGif(20, 10, {
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0},
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0},
+        TestImage{0, 0, 20, 10, indices, -1, -1, 0}});
+    auto valid = [&](const gif::DecodeLimits& limits) {
+        auto it = View(exact).begin();
+        bool parsed = true;
+        try {
+            gif::ParseFileLayout(it, View(exact).end(), &limits);
+        }
+        catch(std::exception&) {
+            parsed = false;
+        }
+        CHECK(gif::ValidateGif(View(exact), &limits).valid == parsed);
+        return parsed;
+    };
+    gif::DecodeLimits limits;
+    limits.maxFrames = 2;
+    CHECK(!valid(limits));
+    limits.maxFrames = 3;
+    CHECK(valid(limits));
+
+    limits = gif::DecodeLimits();
+    limits.maxCanvasPixels = 199;
+    CHECK(!valid(limits));
+    limits.maxCanvasPixels = 200;
+    CHECK(valid(limits));
+
+    limits = gif::DecodeLimits();
+    limits.maxTotalPixels = 599;
+    CHECK(!valid(limits));
+    limits.maxTotalPixels = 600;
+    CHECK(valid(limits));
+}
+
+// every decoder paints the same pixels and continues after the image data
+void TestDecodersAgree()
+{
+    std::mt19937 random(29);
+    for(size_t round = 0; round < 10; ++round) {
+        const uint16_t width = 1 + (random() % 200);
+        const uint16_t height = 1 + (random() % 150);
+        auto images = RandomImages(random, width, height, 6);
+        // noise fills the dictionary several times
+        TestImage noise{0, 0, width, height, {}, -1, -1, 0};
+        noise.indices.resize(size_t(width) * height);
+        for(auto& index : noise.indices) {
+            index = random() & 0xff;
+        }
+        // a interlaced image, every other round also the noise
+        images.front().interlaced = true;
+        noise.interlaced = (round % 2);
+        images.push_back(noise);
+        const auto data = MakeGif(width, height, images);
+        const auto file = ParseTestFile(data);
+        const auto end = file.view.end();
+
+        for(const auto& image : file.images) {
+            const auto& d = image.descriptor;
+            const auto& table = file.globalColorTable;
+            const gif::GraphicControlExtension* gce = image.hasGraphicControl ? &image.gce : nullptr;
+            // decodes the image onto a canvas filled with a pattern
+            using Iterator = std::basic_string_view<uint8_t>::const_iterator;
+            auto decode = [&](const std::function<Iterator(Iterator&, gif::Frame&)>& parse)
+            {
+                gif::Frame frame(width, height);
+                for(size_t i = 0; i < frame.pixels.size(); ++i) {
+                    frame.pixels[i] = static_cast<uint8_t>(i * 13);
+                }
+                auto it = image.data;
+                CHECK(parse(it, frame) == image.next);
+                return frame;
+            };
+
+            const auto serial = decode([&](auto& it, auto& frame) {
+                return gif::ParseImageData(it, end, d, frame, table, gce);
+            });
+            for(size_t workers : {size_t(1), size_t(3)}) {
+                const auto pipelined = decode([&](auto& it, auto& frame) {
+                    return gif::ParseImageDataPipelined(it, end, d, frame, table, gce, workers);
+                });
+                CHECK(pipelined.pixels == serial.pixels);
+                const auto parallel = decode([&](auto& it, auto& frame) {
+                    return gif::ParseImageDataParallel(it, end, d, frame, table, gce, workers + 1);
+                });
+                CHECK(parallel.pixels == serial.pixels);
+            }
+            const auto resumable = decode([&](auto& it, auto& frame) {
+                gif::ImageDecoder decoder(it, end, d, frame, table, gce);
+                gif::DecodeBudget budget;
+                budget.codes = 37;
+                while(decoder.decode(budget) != gif::DecodeStatus::kComplete) {
+                }
+                return decoder.next();
+            });
+            CHECK(resumable.pixels == serial.pixels);
+            const auto region = decode([&](auto& it, auto& frame) {
+                return gif::ParseImageRegion(it, end, d, frame, table, gce, gif::Rect{0, 0, width, height});
+            });
+            CHECK(region.pixels == serial.pixels);
+        }
+    }
+}
+
+// the bands cover the rows of the image in order, the last band holds the
+// remaining rows, and transparent pixels have a zero alpha also where the
+// band storage held opaque pixels of the previous band
+void TestImageBands()
+{
+    std::mt19937 random(27);
+    const uint16_t width = 7;
+    const uint16_t height = 10;
+    std::vector<uint8_t> indices(size_t(width) * height);
+    for(auto& index : indices) {
+        index = random() % 6;
+    }
+    // complete image data, and image data that ends in the sixth row
+    const std::vector<uint8_t> truncated(indices.begin(), indices.begin() + (width * 5) + 3);
+    for(const auto& encoded : {indices, truncated}) {
+        for(int transparent : {-1, 3}) {
+            const auto data = MakeGif(12, 14, {TestImage{3, 2, width, height, encoded, 1, transparent, 0}});
+            const auto file = ParseTestFile(data);
+            const auto& image = file.images[0];
+            const gif::GraphicControlExtension* gce = &image.gce;
+
+            // the pixels painted onto a clear canvas
+            gif::Frame reference(12, 14);
+            auto it = image.data;
+            gif::ParseImageData(it, file.view.end(), image.descriptor, reference, file.globalColorTable, gce);
+            const size_t rows = (encoded.size() == indices.size()) ? height : 5;
+
+            for(size_t bandHeight : {size_t(1), size_t(3), size_t(4), size_t(10), size_t(16)}) {
+                size_t next = 2;
+                bool partial = false;
+                it = image.data;
+                const auto end = gif::ParseImageBands(
+                    it,
+                    file.view.end(),
+                    image.descriptor,
+                    file.globalColorTable,
+                    gce,
+                    bandHeight,
+                    [&](size_t y, size_t count, const gif::Frame& band) {
+                        // only the last band may be partial
+                        CHECK(!partial);
+                        CHECK(y == next);
+                        CHECK((count > 0) && (count <= bandHeight));
+                        CHECK(band.width == width);
+                        CHECK(band.height == std::min<size_t>(bandHeight, height));
+                        partial = (count < bandHeight);
+                        for(size_t row = 0; row < count; ++row) {
+                            const uint8_t* expected = reference.rowPointer(y + row) + (3 * 4);
+                            const uint8_t* pixels = &band.pixels[row * width * 4];
+                            CHECK(std::equal(expected, expected + (width * 4), pixels));
+                            for(size_t x = 0; x < width; ++x) {
+                                const bool clear = (int(indices[((y + row - 2) * width) + x]) == transparent);
+                                CHECK((pixels[(x * 4) + 3] == 0) == clear);
+                            }
+                        }
+                        next = y + count;
+                    });
+                CHECK(end == image.next);
+                CHECK(next == 2 + rows);
+            }
+        }
+    }
+}
+
+// a region paints its intersection with the image like the whole image is
+// painted and leaves the other pixels untouched, and the data following the
+// image is returned also when the decoding stops after the last region row
+void TestImageRegion()
+{
+    std::mt19937 random(34);
+    const uint16_t width = 9;
+    const uint16_t height = 13;
+    std::vector<uint8_t> indices(size_t(width) * height);
+    for(auto& index : indices) {
+        index = random() % 6;
+    }
+    const std::vector<gif::Rect> regions{
+        gif::Rect{0, 0, 14, 16},    // the whole canvas
+        gif::Rect{4, 3, 3, 5},      // inside the image
+        gif::Rect{0, 0, 14, 4},     // the top rows
+        gif::Rect{6, 9, 20, 20},    // past the image and the canvas
+        gif::Rect{11, 0, 3, 16},    // beside the image
+    };
+    gif::Frame background(14, 16);
+    for(size_t i = 0; i < background.pixels.size(); ++i) {
+        background.pixels[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    for(bool interlaced : {false, true}) {
+        for(int transparent : {-1, 2}) {
+            TestImage test{2, 1, width, height, indices, 1, transparent, 0};
+            test.interlaced = interlaced;
+            const auto data = MakeGif(14, 16, {test});
+            const auto file = ParseTestFile(data);
+            const auto& image = file.images[0];
+            const auto& d = image.descriptor;
+            CHECK(d.interlaced == interlaced);
+
+            gif::Frame full = background;
+            auto it = image.data;
+            gif::ParseImageData(it, file.view.end(), d, full, file.globalColorTable, &image.gce);
+            if (interlaced) {
+                // the rows are shown in the same order as without interlacing
+                test.interlaced = false;
+                const auto plain = MakeGif(14, 16, {test});
+                CHECK(ReferenceFrames(plain)[0].pixels == ReferenceFrames(data)[0].pixels);
+            }
+
+            for(const auto& region : regions) {
+                gif::Frame frame = background;
+                it = image.data;
+                const auto next = gif::ParseImageRegion(
+                    it, file.view.end(), d, frame, file.globalColorTable, &image.gce, region);
+                CHECK(next == image.next);
+
+                for(size_t y = 0; y < frame.height; ++y) {
+                    for(size_t x = 0; x < frame.width; ++x) {
+                        const bool inside =
+                            (x >= std::max<size_t>(region.left, d.left)) &&
+                            (x < std::min<size_t>(region.left + region.width, d.left + d.width)) &&
+                            (y >= std::max<size_t>(region.top, d.top)) &&
+                            (y < std::min<size_t>(region.top + region.height, d.top + d.height));
+                        const uint8_t* expected = (inside ? full : background).rowPointer(y) + (x * 4);
+                        CHECK(std::equal(expected, expected + 4, frame.rowPointer(y) + (x * 4)));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// YUV frames match the composited RGBA frames converted to limited range YUV,
+// also for odd frame sizes, images at odd offsets and transparent pixels
+void TestImageDataYuv()
+{
+    struct Layout
+    {
+        uint16_t width;
+        uint16_t height;
+        gif::Rect image;
+    };
+    const std::vector<Layout> layouts{
+        Layout{8, 6, gif::Rect{0, 0, 8, 6}},
+        Layout{13, 9, gif::Rect{3, 2, 7, 5}},
+        Layout{5, 7, gif::Rect{1, 1, 3, 6}},
+        Layout{1, 1, gif::Rect{0, 0, 1, 1}},
+    };
+    std::mt19937 random(32);
+    for(const auto& layout : layouts) {
+        // the background is uniform within each 2x2 block, so that the share
+        // of the chroma kept by transparent pixels is exact
+        TestImage background{0, 0, layout.width, layout.height, {}, 1, -1, 0};
+        for(size_t y = 0; y < layout.height; ++y) {
+            for(size_t x = 0; x < layout.width; ++x) {
+                background.indices.push_back(static_cast<uint8_t>(8 + ((((x / 2) * 3) + ((y / 2) * 5)) % 7)));
+            }
+        }
+        const auto& r = layout.image;
+        std::vector<uint8_t> indices(r.width * r.height);
+        for(auto& index : indices) {
+            index = random() % 6;
+        }
+
+        for(int transparent : {-1, 3}) {
+            for(bool interlaced : {false, true}) {
+                TestImage image{uint16_t(r.left), uint16_t(r.top), uint16_t(r.width), uint16_t(r.height),
+                    indices, 1, transparent, 0};
+                image.interlaced = interlaced;
+                const auto data = MakeGif(layout.width, layout.height, {background, image});
+                const auto file = ParseTestFile(data);
+                const auto expected = ReferenceFrames(data).back();
+
+                for(auto matrix : {gif::ColorMatrix::kBt601, gif::ColorMatrix::kBt709}) {
+                    const double kr = (matrix == gif::ColorMatrix::kBt709) ? 0.2126 : 0.299;
+                    const double kb = (matrix == gif::ColorMatrix::kBt709) ? 0.0722 : 0.114;
+                    // the limited range YUV of a RGBA pixel
+                    auto convert = [&](const uint8_t* p) {
+                        const double luma = ((kr * p[0]) + ((1.0 - kr - kb) * p[1]) + (kb * p[2])) / 255.0;
+                        return std::array<long, 3>{
+                            std::lround(16.0 + (219.0 * luma)),
+                            std::lround(128.0 + (224.0 * ((p[2] / 255.0) - luma) / (2.0 * (1.0 - kb)))),
+                            std::lround(128.0 + (224.0 * ((p[0] / 255.0) - luma) / (2.0 * (1.0 - kr))))};
+                    };
+
+                    for(auto format : {gif::YuvFormat::kI420, gif::YuvFormat::kNV12}) {
+                        gif::YuvFrame frame(layout.width, layout.height, format);
+                        for(const auto& block : file.images) {
+                            auto it = block.data;
+                            const auto next = gif::ParseImageDataYuv(
+                                it, file.view.end(), block.descriptor, frame,
+                                file.globalColorTable, &block.gce, matrix);
+                            CHECK(next == block.next);
+                        }
+
+                        gif::Frame canvas = expected;
+                        for(size_t y = 0; y < frame.height; ++y) {
+                            for(size_t x = 0; x < frame.width; ++x) {
+                                const auto yuv = convert(canvas.rowPointer(y) + (x * 4));
+                                CHECK(frame.y[(y * frame.width) + x] == yuv[0]);
+                            }
+                        }
+                        for(size_t cy = 0; cy < frame.chromaHeight; ++cy) {
+                            for(size_t cx = 0; cx < frame.chromaWidth; ++cx) {
+                                // the average chroma of the pixels of the block
+                                long u = 0;
+                                long v = 0;
+                                long count = 0;
+                                for(size_t y = 2 * cy; y < std::min<size_t>(2 * cy + 2, frame.height); ++y) {
+                                    for(size_t x = 2 * cx; x < std::min<size_t>(2 * cx + 2, frame.width); ++x) {
+                                        const auto yuv = convert(canvas.rowPointer(y) + (x * 4));
+                                        u += yuv[1];
+                                        v += yuv[2];
+                                        ++count;
+                                    }
+                                }
+                                const bool nv12 = (format == gif::YuvFormat::kNV12);
+                                const size_t row = cy * frame.chromaWidth;
+                                const int actualU = nv12 ? frame.u[(row + cx) * 2] : frame.u[row + cx];
+                                const int actualV = nv12 ? frame.u[(row + cx) * 2 + 1] : frame.v[row + cx];
+                                CHECK(std::abs((actualU * count) - u) <= count);
+                                CHECK(std::abs((actualV * count) - v) <= count);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/*                                 Validation                                */
+/*****************************************************************************/
+
+// images must lie within the logical screen, the error is reported at the
+// image descriptor
+void TestValidateImageBounds()
+{
+    const auto inside = MakeGif(4, 4, {
+        TestImage{0, 0, 4, 4, std::vector<uint8_t>(16, 1), -1, -1, 0},
+        TestImage{2, 3, 2, 1, std::vector<uint8_t>(2, 1), 1, -1, 0}});
+    CHECK(gif::ValidateGif(View(inside)).valid);
+
+    const auto right = MakeGif(4, 4, {
+        TestImage{0, 0, 4, 4, std::vector<uint8_t>(16, 1), -1, -1, 0},
+        TestImage{3, 0, 2, 1, std::vector<uint8_t>(2, 1), 1, -1, 0}});
+    const auto result = gif::ValidateGif(View(right));
+    CHECK(!result.valid);
+    CHECK(result.image == 1);
+    CHECK(result.offset < right.size());
+    CHECK(right[result.offset] == 0x2c);
+    CHECK(right[result.offset + 1] == 3);
+
+    const auto below = MakeGif(4, 4, {TestImage{0, 1, 4, 4, std::vector<uint8_t>(16, 1), -1, -1, 0}});
+    CHECK(!gif::ValidateGif(View(below)).valid);
+}
+
+// errors in the image data and a missing trailer are reported with the image
+// and the offset where they were detected
+void TestValidateErrors()
+{
+    const TestImage first{0, 0, 4, 4, std::vector<uint8_t>(16, 1), -1, -1, 0};
+    auto withSecond = [&](const std::vector<uint8_t>& indices) {
+        return MakeGif(4, 4, {first, TestImage{0, 0, 4, 4, indices, 1, -1, 0}});
+    };
+    CHECK(gif::ValidateGif(View(withSecond(std::vector<uint8_t>(16, 2)))).valid);
+
+    // the pixel count is checked once the image data has been read, the
+    // error points at the start of the image data
+    for(size_t count : {size_t(15), size_t(17)}) {
+        const auto data = withSecond(std::vector<uint8_t>(count, 2));
+        const auto file = ParseTestFile(data);
+        const auto result = gif::ValidateGif(View(data));
+        CHECK(!result.valid);
+        CHECK(result.image == 1);
+        CHECK(result.offset == size_t(file.images[1].data - file.view.begin()));
+    }
+
+    // a code beyond the next dictionary entry, with a minimum code size of 2
+    // the codes clear, 0 and 7 are packed into the bytes 0xc4 and 0x01
+    auto data = withSecond(std::vector<uint8_t>(16, 2));
+    {
+        const auto file = ParseTestFile(data);
+        const size_t begin = file.images[1].data - file.view.begin();
+        const size_t end = file.images[1].next - file.view.begin();
+        data.erase(data.begin() + begin, data.begin() + end);
+        data.insert(data.begin() + begin, {0x02, 0x02, 0xc4, 0x01, 0x00});
+        const auto result = gif::ValidateGif(View(data));
+        CHECK(!result.valid);
+        CHECK(result.image == 1);
+        // the byte following the invalid code
+        CHECK(result.offset == begin + 4);
+    }
+
+    // the file ends after the last image
+    data = withSecond(std::vector<uint8_t>(16, 2));
+    data.pop_back();
+    const auto result = gif::ValidateGif(View(data));
+    CHECK(!result.valid);
+    CHECK(result.image == SIZE_MAX);
+    CHECK(result.offset == data.size());
+}
+
+/*****************************************************************************/
+/*                                   Remux                                   */
+/*****************************************************************************/
+
+// every range of frames is written as a valid file that shows the same frames
+void TestRemuxRanges()
+{
+    std::mt19937 random(37);
+    const auto data = MakeGif(32, 24, RandomImages(random, 32, 24, 12));
+    const auto reference = ReferenceFrames(data);
+    for(size_t first = 0; first < reference.size(); ++first) {
+        for(size_t count : {size_t(0), size_t(1), size_t(3)}) {
+            gif::RemuxOptions options;
+            options.first = first;
+            options.count = count;
+            const auto remuxed = gif::RemuxGif(View(data), options);
+            const auto result = gif::ValidateGif(View(remuxed));
+            CHECK(result.valid);
+            if (!result.valid) {
+                std::cerr << "  frames " << first << "+" << count << ": " << result.message << std::endl;
+                continue;
+            }
+
+            const auto frames = ReferenceFrames(remuxed);
+            const size_t expected = count ?
+                std::min(count, reference.size() - first) : (reference.size() - first);
+            CHECK(frames.size() == expected);
+            for(size_t i = 0; i < std::min(frames.size(), expected); ++i) {
+                CHECK(frames[i].pixels == reference[first + i].pixels);
+            }
+        }
+    }
+}
+
+// a re-encoded frame whose colors and transparent pixels don't fit in a
+// single color table is written as several images
+void TestRemuxManyColors()
+{
+    std::vector<uint8_t> all(256);
+    for(size_t i = 0; i < all.size(); ++i) {
+        all[i] = static_cast<uint8_t>(i);
+    }
+    std::vector<uint8_t> fewer = all;
+    fewer.back() = 0;
+    gif::ColorTable gray(128);
+    for(size_t i = 0; i < gray.size(); ++i) {
+        gray[i] = gif::Color{uint8_t(i), uint8_t(i), uint8_t(i)};
+    }
+    const TestImage fewColors{0, 0, 32, 8, fewer, 1, -1, 10};
+    const TestImage allColors{0, 0, 32, 8, all, 1, -1, 10};
+    const TestImage moreColors{0, 8, 32, 4, std::vector<uint8_t>(all.begin(), all.begin() + 128), 1, -1, 10, gray};
+    const TestImage pixel{0, 15, 1, 1, {5}, 1, -1, 20};
+    const TestImage clearedPixel{0, 15, 1, 1, {5}, 2, -1, 20};
+
+    // the number of images written for each remuxed frame, starting at the
+    // second frame of each file
+    const std::vector<std::pair<std::vector<TestImage>, std::vector<size_t>>> inputs{
+        {{fewColors, pixel}, {1}},
+        {{allColors, pixel}, {2}},
+        {{allColors, moreColors}, {2}},
+        {{allColors, clearedPixel, pixel}, {2, 2}},
+    };
+    for(const auto& input : inputs) {
+        const auto data = MakeGif(32, 16, input.first);
+        const auto reference = ReferenceFrames(data);
+        gif::RemuxOptions options;
+        options.first = 1;
+        const auto remuxed = gif::RemuxGif(View(data), options);
+        const auto result = gif::ValidateGif(View(remuxed));
+        CHECK(result.valid);
+        if (!result.valid) {
+            std::cerr << "  " << result.message << std::endl;
+            continue;
+        }
+
+        const auto file = ParseTestFile(remuxed);
+        const auto frames = ReferenceFrames(remuxed);
+        size_t images = 0;
+        for(size_t count : input.second) {
+            images += count;
+        }
+        CHECK(frames.size() == images);
+        if (frames.size() != images) {
+            continue;
+        }
+        size_t image = 0;
+        for(size_t i = 0; i < input.second.size(); ++i) {
+            // the images of a frame are shown without delay, except the last
+            for(size_t j = 0; j < input.second[i]; ++j, ++image) {
+                const bool last = (j + 1 == input.second[i]);
+                const auto& gce = file.images[image].gce;
+                CHECK(file.images[image].hasGraphicControl);
+                CHECK(gce.delayTime == (last ? input.first[i + 1].delay : 0));
+                CHECK(gce.transparentColorFlag);
+                CHECK(gce.disposalMethod == (last ? input.first[i + 1].disposal : 1));
+            }
+            CHECK(frames[image - 1].pixels == reference[i + 1].pixels);
+        }
+        if (file.images.size() == 1) {
+            // the only index that the 255 colors leave unused
+            CHECK(file.images[0].gce.transparentColorIndex == 255);
+        }
+    }
+}
+
+/*****************************************************************************/
+/*                              SharedFrameCache                             */
+/*****************************************************************************/
+
+// the references of a process that exits without releasing them don't keep
+// the entry from being evicted
+void TestSharedCacheReapsDeadProcesses()
+{
+    const std::string name = "/gif_unit_tests." + std::to_string(getpid());
+    const auto first = MakeGif(8, 8, {TestImage{0, 0, 8, 8, std::vector<uint8_t>(64, 1), -1, -1, 0}});
+    const auto second = MakeGif(8, 8, {TestImage{0, 0, 8, 8, std::vector<uint8_t>(64, 2), -1, -1, 0}});
+    // room for the frames of a single file
+    const size_t budget = 400;
+    gif::SharedFrameCache::remove(name);
+
+    const pid_t child = fork();
+    if (child == 0) {
+        gif::SharedFrameCache cache(name, budget, 4);
+        auto frames = cache.get(View(first));
+        // exit while holding the reference
+        _exit(frames->shared() ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    {
+        gif::SharedFrameCache cache(name, budget, 4);
+        const auto frames = cache.get(View(second));
+        CHECK(frames->shared());
+        const auto table = TestColorTable();
+        CHECK(frames->pixels(0)[0] == table[2].r);
+        CHECK(frames->pixels(0)[1] == table[2].g);
+    }
+    gif::SharedFrameCache::remove(name);
+}
+
+// a file that doesn't fit in the budget is read from a private frame store
+// that shows the same frames
+void TestSharedCachePrivateFrames()
+{
+    const std::string name = "/gif_unit_tests." + std::to_string(getpid());
+    std::mt19937 random(38);
+    const auto images = RandomImages(random, 16, 12, 8);
+    const auto data = MakeGif(16, 12, images);
+    const auto reference = ReferenceFrames(data);
+    gif::SharedFrameCache::remove(name);
+    {
+        gif::SharedFrameCache cache(name, 1024, 4);
+        const auto frames = cache.get(View(data));
+        CHECK(!frames->shared());
+        CHECK(cache.memoryUsage() == 0);
+        CHECK(frames->size() == reference.size());
+        CHECK((frames->width() == 16) && (frames->height() == 12));
+        for(size_t i = frames->size(); i > 0; --i) {
+            const size_t index = (i * 3) % frames->size();
+            const auto& expected = reference[index].pixels;
+            CHECK(std::equal(expected.begin(), expected.end(), frames->pixels(index)));
+            CHECK(frames->delay(index) == ((images[index].disposal >= 0) ? images[index].delay : 0));
+        }
+    }
+    gif::SharedFrameCache::remove(name);
+}
+
+/*****************************************************************************/
+/*                                BatchDecoder                               */
+/*****************************************************************************/
+
+// every file is reported once through its future and once through the
+// callback, and a file that fails doesn't affect the others
+void TestBatchDecoder()
+{
+    std::vector<std::vector<uint8_t>> files;
+    for(uint8_t i = 0; i < 4; ++i) {
+        files.push_back(MakeGif(6, 4, DisposalImages(i)));
+    }
+    auto truncated = files[0];
+    truncated.resize(truncated.size() / 2);
+    files.push_back(truncated);
+
+    const std::string path = "/tmp/gif_unit_tests." + std::to_string(getpid()) + ".gif";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(files[1].data()), files[1].size());
+    }
+
+    std::vector<gif::BatchInput> inputs;
+    for(const auto& file : files) {
+        inputs.push_back(View(file));
+    }
+    inputs.push_back(path);
+    inputs.push_back(std::string("/nonexistent/unit_tests.gif"));
+    // the file that each input holds, or -1 if it fails
+    const int expected[] = {0, 1, 2, 3, -1, 1, -1};
+
+    // a callback that throws doesn't change the results, and isn't called
+    // a second time
+    for(bool throwing : {false, true}) {
+        std::mutex mutex;
+        std::vector<int> calls(inputs.size(), 0);
+        std::vector<bool> decoded(inputs.size(), false);
+        gif::BatchDecoder decoder(4);
+        auto futures = decoder.decode(inputs,
+            [&](size_t index, const gif::FrameStore* frames, std::exception_ptr error) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++calls[index];
+                decoded[index] = frames && !error;
+                if (throwing) {
+                    throw std::runtime_error("Callback failure.");
+                }
+            });
+        CHECK(futures.size() == inputs.size());
+
+        for(size_t i = 0; i < futures.size(); ++i) {
+            try {
+                const auto frames = futures[i].get();
+                CHECK(expected[i] >= 0);
+                if (expected[i] >= 0) {
+                    const auto reference = ReferenceFrames(files[expected[i]]);
+                    CHECK(frames.size() == reference.size());
+                    gif::Frame canvas(6, 4);
+                    for(size_t j = 0; j < std::min(frames.size(), reference.size()); ++j) {
+                        frames.read(j, canvas);
+                        CHECK(canvas.pixels == reference[j].pixels);
+                    }
+                }
+            }
+            catch(std::exception&) {
+                CHECK(expected[i] < 0);
+            }
+        }
+
+        // the callback runs before the future is made ready
+        std::lock_guard<std::mutex> lock(mutex);
+        for(size_t i = 0; i < inputs.size(); ++i) {
+            CHECK(calls[i] == 1);
+            CHECK(decoded[i] == (expected[i] >= 0));
+        }
+    }
+    std::remove(path.c_str());
+}
+
+/*****************************************************************************/
+/*                                 ThreadPool                                */
+/*****************************************************************************/
+
+// every task submits more tasks from the worker threads, which exercises the
+// claiming of tasks that are pushed while other workers are stealing
+void TestThreadPoolNestedSubmit()
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    for(size_t round = 0; std::chrono::steady_clock::now() < deadline; ++round) {
+        gif::ThreadPool pool(8);
+        const size_t outer = 64;
+        const size_t inner = 4;
+        std::atomic<size_t> done(0);
+        std::mutex mutex;
+        std::condition_variable condition;
+        auto finish = [&]() {
+            if (++done == outer * (inner + 1)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                condition.notify_all();
+            }
+        };
+        for(size_t i = 0; i < outer; ++i) {
+            pool.submit([&]() {
+                for(size_t j = 0; j < inner; ++j) {
+                    pool.submit(finish);
+                }
+                finish();
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        const bool completed = condition.wait_for(
+            lock,
+            std::chrono::seconds(10),
+            [&]() { return done == outer * (inner + 1); });
+        CHECK(completed);
+        if (!completed) {
+            std::cerr << "stalled in round " << round << " with " << done
+                << " tasks done" << std::endl;
+            std::terminate();
+        }
+    }
+}
+
+} // namespace
+
+int main()
+{
+    const std::pair<const char*, std::function<void()>> tests[] = {
+        {"FrameStoreDisposal", TestFrameStoreDisposal},
+        {"FrameStoreRestorePreviousKeyFrame", TestFrameStoreRestorePreviousKeyFrame},
+        {"FrameStoreRoundTrip", TestFrameStoreRoundTrip},
+        {"FrameStoreDuplicates", TestFrameStoreDuplicates},
+        {"ParallelPartialData", TestParallelPartialData},
+        {"ImageDecoderTimeLimit", TestImageDecoderTimeLimit},
+        {"TruncatedImageData", TestTruncatedImageData},
+        {"DecodeLimits", TestDecodeLimits},
+        {"DecodersAgree", TestDecodersAgree},
+        {"ImageBands", TestImageBands},
+        {"ImageRegion", TestImageRegion},
+        {"ImageDataYuv", TestImageDataYuv},
+        {"ValidateImageBounds", TestValidateImageBounds},
+        {"ValidateErrors", TestValidateErrors},
+        {"RemuxRanges", TestRemuxRanges},
+        {"RemuxManyColors", TestRemuxManyColors},
+        {"SharedCacheReapsDeadProcesses", TestSharedCacheReapsDeadProcesses},
+        {"SharedCachePrivateFrames", TestSharedCachePrivateFrames},
+        {"BatchDecoder", TestBatchDecoder},
+        {"ThreadPoolNestedSubmit", TestThreadPoolNestedSubmit},
+    };
+    for(const auto& test : tests) {
+        const int before = failures;
+        try {
+            test.second();
+        }
+        catch(std::exception& err) {
+            std::cerr << "Caught exception: " << err.what() << std::endl;
+            ++failures;
+        }
+        std::cout << (failures == before ? "[  OK  ] " : "[FAILED] ") << test.first << std::endl;
+    }
+    return failures ? 1 : 0;
+}